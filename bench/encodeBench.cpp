@@ -0,0 +1,149 @@
+/* encodeBench.cpp
+ *  compare the compressed size and speed of the encoder variants on the
+ *  8x8 tiles of a BMP file. Tiles are split into nibble planes up front, so
+ *  only the encoder itself is timed.
+ *
+ *  usage: bench_encode image.bmp [repeats]
+ */
+#include "nibblePlanes.h"
+#include "rgbTileProc.h"
+#include "tileEncoder.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+typedef struct _BenchResult {
+  long long compressedBytes;
+  double nsPerTile;
+} BenchResult;
+
+static std::vector<unsigned char> gatherTiles(const unsigned char *data,
+                                              int width, int height,
+                                              int *pTileCount) {
+  const int TILE_WIDTH = 8;
+  const int TILE_HEIGHT = 8;
+  int numRows = height / TILE_HEIGHT;
+  int numColumns = width / TILE_WIDTH;
+  std::vector<unsigned char> tiles(numRows * numColumns * TILE_WIDTH *
+                                   TILE_HEIGHT * 4);
+  unsigned char *pClr = tiles.data();
+  for (int tileRow = 0; tileRow < numRows; tileRow++) {
+    for (int tileColumn = 0; tileColumn < numColumns; tileColumn++) {
+      for (int i = 0; i < TILE_HEIGHT; i++) {
+        memcpy(pClr,
+               data + ((tileRow * TILE_HEIGHT + i) * width +
+                       tileColumn * TILE_WIDTH) * 4,
+               TILE_WIDTH * 4);
+        pClr += TILE_WIDTH * 4;
+      }
+    }
+  }
+  *pTileCount = numRows * numColumns;
+  return tiles;
+}
+
+typedef std::function<int(const unsigned char *, unsigned char *)>
+    EncodeFunction;
+
+static BenchResult run(const EncodeFunction &encodeTile,
+                       const unsigned char *pPlanes, int tileCount,
+                       int repeats) {
+  const int TILE_BYTES = 8 * 8 * 4;
+  unsigned char pTile[2 * TILE_BYTES];
+  BenchResult result = {0, 0};
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeats; r++) {
+    long long total = 0;
+    for (int i = 0; i < tileCount; i++) {
+      total += encodeTile(pPlanes + i * TILE_BYTES, pTile);
+    }
+    result.compressedBytes = total;
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  result.nsPerTile = elapsed.count() / repeats / tileCount;
+  return result;
+}
+
+static void report(const char *name, BenchResult result, int tileCount) {
+  printf("%-12s %12lld bytes  %7.3f%%  %8.1f ns/tile\n", name,
+         result.compressedBytes,
+         100.0 * result.compressedBytes / (tileCount * 8.0 * 8.0 * 4.0),
+         result.nsPerTile);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s image.bmp [repeats]\n", argv[0]);
+    return -1;
+  }
+  int repeats = argc >= 3 ? atoi(argv[2]) : 10;
+  int width, height, nrChannels;
+  unsigned char *data =
+      stbi_load(argv[1], &width, &height, &nrChannels, STBI_rgb_alpha);
+  if (data == NULL) {
+    printf("cannot open file: %s\n", argv[1]);
+    return -3;
+  }
+  int tileCount = 0;
+  std::vector<unsigned char> tiles =
+      gatherTiles(data, width, height, &tileCount);
+  stbi_image_free(data);
+  printf("%s: %dx%d, %d tiles, %d repeats\n", argv[1], width, height,
+         tileCount, repeats);
+
+  const int TILE_BYTES = 8 * 8 * 4;
+  std::vector<unsigned char> planes(tiles.size());
+  for (int i = 0; i < tileCount; i++) {
+    splitNibbles(tiles.data() + i * TILE_BYTES, planes.data() + i * TILE_BYTES,
+                 TILE_BYTES);
+  }
+
+  EncodeContext *pContext = EncodeContext_init();
+  report("generic",
+         run(
+             [&](const unsigned char *pPlanes, unsigned char *pTile) {
+               int tileSize = 0;
+               EncodeContext_encode(pContext, pTile, &tileSize, pPlanes,
+                                    TILE_BYTES);
+               return tileSize;
+             },
+             planes.data(), tileCount, repeats),
+         tileCount);
+  EncodeContext_free(pContext);
+
+  pContext = EncodeContext_initCompact(TILE_BYTES);
+  report("compact",
+         run(
+             [&](const unsigned char *pPlanes, unsigned char *pTile) {
+               int tileSize = 0;
+               EncodeContext_encode(pContext, pTile, &tileSize, pPlanes,
+                                    TILE_BYTES);
+               return tileSize;
+             },
+             planes.data(), tileCount, repeats),
+         tileCount);
+  EncodeContext_free(pContext);
+
+  for (int level = TILE_LEVEL_COMPAT; level <= TILE_LEVEL_OPTIMAL; level++) {
+    TileEncoderBase *pEncoder =
+        createTileEncoder(8, 8, level != TILE_LEVEL_COMPAT, level);
+    char name[32];
+    snprintf(name, sizeof(name), "tpl -l %d", level);
+    report(name,
+           run(
+               [&](const unsigned char *pPlanes, unsigned char *pTile) {
+                 return pEncoder->encode(pPlanes, pTile);
+               },
+               planes.data(), tileCount, repeats),
+           tileCount);
+    delete pEncoder;
+  }
+  return 0;
+}
@@ -0,0 +1,119 @@
+/* updateBench.cpp
+ *  compare re-encoding a whole image with jlcdUpdate() on the rectangles
+ *  of a blinking text cursor, and check the updated image decodes to the
+ *  new frame.
+ *
+ *  usage: bench_update image.bmp [level] [blinks]
+ */
+#include "defines.h"
+#include "jlcdFile.h"
+#include "jlcdImage.h"
+#include "rgbTileProc.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+/* decode every tile of `image` and compare it with `pRGBA` */
+static bool decodesTo(const std::vector<unsigned char> &image,
+                      const unsigned char *pRGBA, int width) {
+  JlcdFile file;
+  if (jlcdParse(&file, image.data(), image.size()) != ERROR_OK) {
+    return false;
+  }
+  TileCodec *pCodec = tileCodecInit(file.tileWidth, file.tileHeight);
+  int numColumns = file.imgWidth / file.tileWidth;
+  int rowBytes = file.tileWidth * 4;
+  unsigned char pARGB[TILE_MAX_BYTES];
+  bool same = true;
+  for (int tileIndex = 0; same && tileIndex < file.tileCount; tileIndex++) {
+    const unsigned char *pTile;
+    int size;
+    jlcdGetTile(&file, tileIndex, &pTile, &size);
+    if (tile2argbWithCodec(pCodec, pTile, size, pARGB) != 0) {
+      same = false;
+      break;
+    }
+    int row = tileIndex / numColumns;
+    int column = tileIndex % numColumns;
+    for (int i = 0; same && i < file.tileHeight; i++) {
+      same = memcmp(pARGB + i * rowBytes,
+                    pRGBA + ((size_t)(row * file.tileHeight + i) * width +
+                             column * file.tileWidth) * 4,
+                    rowBytes) == 0;
+    }
+  }
+  tileCodecFree(pCodec);
+  jlcdClose(&file);
+  return same;
+}
+
+/* draw or erase a 2x16 cursor, inverting the pixels under it */
+static void toggleCursor(unsigned char *pRGBA, int width, JlcdRect rect) {
+  for (int y = rect.y; y < rect.y + rect.height; y++) {
+    for (int x = rect.x; x < rect.x + rect.width; x++) {
+      unsigned char *pPixel = pRGBA + ((size_t)y * width + x) * 4;
+      pPixel[0] ^= 0xff;
+      pPixel[1] ^= 0xff;
+      pPixel[2] ^= 0xff;
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("usage: %s image.bmp [level] [blinks]\n", argv[0]);
+    return -1;
+  }
+  int level = argc >= 3 ? atoi(argv[2]) : TILE_LEVEL_COMPAT;
+  int blinks = argc >= 4 ? atoi(argv[3]) : 1000;
+  int width, height, nrChannels;
+  unsigned char *data =
+      stbi_load(argv[1], &width, &height, &nrChannels, STBI_rgb_alpha);
+  if (data == NULL || width < 16 || height < 32) {
+    printf("cannot open file: %s\n", argv[1]);
+    return -3;
+  }
+  ptrdiff_t pitch = (ptrdiff_t)width * 4;
+
+  for (int version = 1; version <= 2; version++) {
+    std::vector<unsigned char> image;
+    auto start = std::chrono::steady_clock::now();
+    // version 1 holds level 0 tiles only
+    int versionLevel = version == 1 ? TILE_LEVEL_COMPAT : level;
+    jlcdEncode(image, data, pitch, width, height, versionLevel, version);
+    std::chrono::duration<double, std::micro> full =
+        std::chrono::steady_clock::now() - start;
+    size_t encodedSize = image.size();
+
+    // the cursor blinks at a few spots, as when typing
+    srand(1);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < blinks; i++) {
+      JlcdRect cursor = {rand() % (width - 2), rand() % (height - 16), 2,
+                         16};
+      for (int blink = 0; blink < 2; blink++) {
+        toggleCursor(data, width, cursor);
+        jlcdUpdate(image, data, pitch, &cursor, 1, versionLevel);
+      }
+    }
+    std::chrono::duration<double, std::micro> update =
+        std::chrono::steady_clock::now() - start;
+    size_t updatedSize = image.size();
+    bool same = decodesTo(image, data, width);
+    if (version == 1) {
+      jlcdCompact(image);
+    }
+    printf("v%d -l %d: full encode %9.1f us, blink update %7.2f us, "
+           "%zu -> %zu bytes (compacted %zu)%s\n",
+           version, versionLevel, full.count(), update.count() / (2 * blinks),
+           encodedSize, updatedSize, image.size(),
+           same && decodesTo(image, data, width) ? "" : " MISMATCH");
+  }
+  stbi_image_free(data);
+  return 0;
+}
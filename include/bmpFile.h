@@ -0,0 +1,115 @@
+/* bmpFile.h
+ *  strip-wise reading of uncompressed 24 and 32 bit BMP files, so that an
+ *  image can be encoded without holding all of it in memory, and writing
+ *  of 32 bit BMP files laid out like stbi_write_bmp() output
+ */
+#ifndef _BMPFILE_H_
+#define _BMPFILE_H_
+
+#include <cstddef>
+#include <cstdio>
+
+typedef struct _BmpFile {
+  int width;
+  int height;
+  int channels; // 3 or 4, as stbi_load() reports them
+
+  // the whole file where it can be mapped, read strip by strip otherwise;
+  // writable for a file from bmpCreate()
+  unsigned char *pFileData;
+  size_t fileSize;
+  FILE *fp;
+  long dataOffset;
+  int bitsPerPixel; // 24 or 32
+  int rowStride;    // bytes per row in the file, padded to 4
+  int topDown;      // rows stored top first (negative height)
+  int hasAlpha;     // 32 bit with an alpha channel
+  int forceOpaque;  // alpha channel all 0, read as 255 like stbi_load()
+
+  unsigned char *pStrip; // file rows of the last strip read
+  int stripCapacity;     // rows pStrip holds
+} BmpFile;
+
+/* open a BMP file for bmpReadRows()
+ *  return:
+ *    ERROR_OK                 -- succeed
+ *    ERROR_INPUT_FILE         -- cannot open the file
+ *    ERROR_INVALID_INPUT_FILE -- not a BMP layout handled here (palette,
+ *                                RLE, 16 bit, odd masks, truncated);
+ *                                stbi_load() may still read it
+ */
+int bmpOpen(BmpFile *pFile, char const *fileName);
+
+/* read `rowCount` rows starting `firstRow` rows from the top, as RGBA
+ * bytes in the layout of stbi_load(..., STBI_rgb_alpha)
+ *  return:
+ *    ERROR_OK          -- succeed
+ *    ERROR_INPUT_FILE  -- read failed
+ */
+int bmpReadRows(BmpFile *pFile, int firstRow, int rowCount,
+                unsigned char *pRGBA);
+
+void bmpClose(BmpFile *pFile);
+
+/* write `pRGBA` (stbi_load() layout) as a bottom-up 32 bit BMP with a V4
+ * header and BI_BITFIELDS masks, the file stbi_write_bmp() writes
+ *  return:
+ *    ERROR_OK           -- succeed
+ *    ERROR_OUTPUT_FILE  -- cannot create or write the file
+ */
+int bmpWrite(char const *fileName, int width, int height,
+             const unsigned char *pRGBA);
+
+/* return 1 when a `width` x `height` file from bmpWrite() or bmpCreate()
+ * has a size its 32 bit header field can hold, 0 otherwise
+ */
+int bmpWriteFits(int width, int height);
+
+/* create `fileName` as the file bmpWrite() would write, mapped so that its
+ * rows are filled in place through bmpMutableRow(); the pixels start out
+ * as zeros and the file is complete once bmpClose() returns
+ *  return:
+ *    ERROR_OK           -- succeed
+ *    ERROR_OUTPUT_FILE  -- cannot create or map the file; bmpWrite() may
+ *                          still work where mapping does not
+ */
+int bmpCreate(BmpFile *pFile, char const *fileName, int width, int height);
+
+/* convert `count` pixels of 32 bit BMP data (B, G, R, A) to the RGBA
+ * order of bmpReadRows(); `forceOpaque` sets every alpha to 255. `pSrc`
+ * and `pDst` may be the same. Swapping B and R is its own inverse, so with
+ * `forceOpaque` 0 this also converts RGBA to BMP order.
+ */
+void bmpPixelsToRGBA(const unsigned char *pSrc, unsigned char *pDst,
+                     int count, int forceOpaque);
+
+/* the pixels of row `row` counted from the top, as stored in a mapped
+ * file, or NULL when the file is not mapped
+ */
+inline const unsigned char *bmpRowPointer(const BmpFile *pFile, int row) {
+  if (pFile->pFileData == NULL) {
+    return NULL;
+  }
+  int fileRow = pFile->topDown ? row : pFile->height - 1 - row;
+  return pFile->pFileData + pFile->dataOffset +
+         (size_t)fileRow * pFile->rowStride;
+}
+
+/* row `row` counted from the top of a file from bmpCreate() */
+inline unsigned char *bmpMutableRow(BmpFile *pFile, int row) {
+  int fileRow = pFile->topDown ? row : pFile->height - 1 - row;
+  return pFile->pFileData + pFile->dataOffset +
+         (size_t)fileRow * pFile->rowStride;
+}
+
+/* tell the system rows [firstRow, firstRow + rowCount) counted from the
+ * top are done with, so a mapped file does not stay resident as a whole
+ */
+void bmpReleaseRows(BmpFile *pFile, int firstRow, int rowCount);
+
+/* bytes from a row returned by bmpRowPointer() to the one below it */
+inline ptrdiff_t bmpRowPitch(const BmpFile *pFile) {
+  return pFile->topDown ? pFile->rowStride : -(ptrdiff_t)pFile->rowStride;
+}
+
+#endif
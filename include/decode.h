@@ -11,6 +11,25 @@ extern "C" {
 /// allocated by caller
 int decode(const unsigned char *pTile, int nTileSize, unsigned char *pClrBlk);
 
+/// Bytes past the decoded data that `decodeFast` may overwrite.
+#define DECODE_SLACK 32
+
+/// Same output as `decode`, but copies literals and matches in 8/16/32-byte
+/// chunks and expands 1/2/4-byte repeats from a replicated pattern.
+/// @param pClrBlk Must have room for the decoded data plus `DECODE_SLACK`
+/// bytes. The slack bytes are left with unspecified contents.
+int decodeFast(const unsigned char *pTile, int nTileSize,
+               unsigned char *pClrBlk);
+
+/// Bounds-checked decode for untrusted tiles. Never reads outside `pTile`,
+/// never writes outside `pClrBlk`, and rejects malformed tokens and match
+/// offsets pointing before `pClrBlk`. Uses the `decodeFast` kernels while
+/// at least `DECODE_SLACK` bytes of capacity remain past the current token.
+/// @param nClrBlkCapacity Size of the buffer at `pClrBlk`(Byte).
+/// @return Number of decoded bytes, or -1 if the tile is malformed.
+int decodeSafe(const unsigned char *pTile, int nTileSize,
+               unsigned char *pClrBlk, int nClrBlkCapacity);
+
 #ifdef __cplusplus
 }
 #endif
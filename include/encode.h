@@ -7,9 +7,35 @@ extern "C" {
 
 /// @param pTile Pointer point to encoded data.
 /// @param nTileSize The size of the encoded data(Byte).
-/// @param pClrBlk Pointer point to original data.
+/// @param pClrBlk Pointer point to original data, as large as the tile set
+/// by `tileSetSize`.
 int encode(unsigned char *pTile, int *pTileSize, const unsigned char *pClrBlk);
 
+/// Encoder state that can be reused across tiles, so that encoding a tile
+/// does not allocate or clear the hash table.
+typedef struct EncodeContext_ EncodeContext;
+
+EncodeContext *EncodeContext_init(void);
+
+/// Context with a compact match finder: 16-bit positions and 8-10 hash bits
+/// scaled to `max_input_size`, so the table fits in 0.5-2 KB of L1. Output
+/// differs from `encode` but uses the same token format.
+/// @param max_input_size Largest input (Byte) that will be encoded, at most
+/// 16384.
+/// @return NULL if `max_input_size` is out of range.
+EncodeContext *EncodeContext_initCompact(int max_input_size);
+
+void EncodeContext_free(EncodeContext *self);
+
+/// Same as `encode`, but with the state kept in `self` and the input size
+/// passed explicitly. The output is identical to `encode` for the same input.
+/// @param nClrBlkSize The size of the original data(Byte).
+/// @return 0, or -1 if `nClrBlkSize` exceeds what a compact context was
+/// created for.
+int EncodeContext_encode(EncodeContext *self, unsigned char *pTile,
+                         int *pTileSize, const unsigned char *pClrBlk,
+                         int nClrBlkSize);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,130 @@
+/* jlcdFile.h
+ *  read-only access to JLCD files
+ */
+#ifndef _JLCDFILE_H_
+#define _JLCDFILE_H_
+
+#include <cstddef>
+#include <cstring>
+
+/* all versions share the header: magic, ImgWidth, ImgHeight, TileWidth,
+ * TileHeight and TileCount. Version 1 follows it with TileCount x
+ * {int32 TilePos, int32 TileLen}, version 2 with TileCount x uint16 TileLen
+ * and the tiles stored back to back in index order.
+ *
+ * A sequence (version 3) holds frames of one size: int32 FrameCount after
+ * the header, then per frame uint32 FrameSize and FrameSize bytes laid out
+ * as a version 2 index and its tiles. A TileLen of 0 keeps the tile of the
+ * previous frame; the first frame has none.
+ *
+ * Readers that predate version 2 take every version 1 tile for a token
+ * stream, so version 1 files hold TILE_LEVEL_COMPAT tiles only. Uniform
+ * and stored tiles, written at the other levels, go into versions 2 and 3,
+ * whose magic those readers refuse.
+ */
+#define JLCD_MAGIC "JLCD"
+#define JLCD_V2_MAGIC "JLC2"
+#define JLCD_SEQ_MAGIC "JLCS"
+#define JLCD_HEADER_SIZE 24
+#define JLCD_SEQ_HEADER_SIZE 28
+#define JLCD_FRAME_HEADER_SIZE 4
+#define JLCD_TILE_INFO_SIZE 8
+#define JLCD_V2_TILE_INFO_SIZE 2
+
+typedef struct _JlcdFile {
+  int version; // 1, 2 or 3 (sequence)
+  int imgWidth;
+  int imgHeight;
+  int tileWidth;
+  int tileHeight;
+  int tileCount;
+
+  const unsigned char *pTileInfos; // the index as stored in the file
+  const unsigned char *pTileData;  // TileData[0]
+  size_t tileDataSize;
+  // version 2 and 3: TileCount + 1 offsets into pTileData, summed up at
+  // load or frame selection
+  unsigned int *pTileOffsets;
+
+  // version 3: the selected frame and where every frame starts, FrameCount
+  // + 1 file offsets; other versions have one frame
+  int frameCount;
+  int frame;
+  size_t *pFrameOffsets;
+
+  // whole file, owned by the JlcdFile when opened with jlcdOpen()
+  const unsigned char *pFileData;
+  size_t fileSize;
+  int ownsFileData;
+} JlcdFile;
+
+/* map a JLCD file and validate its header and tile index
+ *  return:
+ *    ERROR_OK                 -- succeed
+ *    ERROR_INPUT_FILE         -- cannot open or map the file
+ *    ERROR_INVALID_INPUT_FILE -- not a valid JLCD file
+ */
+int jlcdOpen(JlcdFile *pFile, char const *fileName);
+
+/* same as jlcdOpen, for reading a few tiles of a large file: the tile
+ * spans of a version 1 file are not checked, nor its pages read ahead, so
+ * that only the header and the tiles read are touched. Check each tile
+ * with jlcdCheckTile() before jlcdGetTile(). Other versions are opened as
+ * by jlcdOpen(), since their offsets come from the whole index.
+ */
+int jlcdOpenHeader(JlcdFile *pFile, char const *fileName);
+
+/* same as jlcdOpen, for a JLCD image already in memory. `pData` is
+ * borrowed and must outlive `pFile`, which still needs jlcdClose().
+ */
+int jlcdParse(JlcdFile *pFile, const unsigned char *pData, size_t size);
+
+/* the first part of jlcdParse(): check the header and locate the tile
+ * index of a version 1 or 2 image, without reading it. Tile spans are not
+ * checked and jlcdGetTile() needs jlcdParse(); `pFile` still needs
+ * jlcdClose().
+ */
+int jlcdParseHeader(JlcdFile *pFile, const unsigned char *pData,
+                    size_t size);
+
+void jlcdClose(JlcdFile *pFile);
+
+/* point the tile index of a sequence at frame `frame`; jlcdOpen() and
+ * jlcdParse() select frame 0. Tiles of size 0 are the ones kept from the
+ * previous frame.
+ *  return:
+ *    ERROR_OK                 -- succeed
+ *    ERROR_INVALID_PARAM      -- no such frame
+ *    ERROR_INVALID_INPUT_FILE -- the frame's index is invalid
+ */
+int jlcdSelectFrame(JlcdFile *pFile, int frame);
+
+/* check that the span of tile `tileIndex` lies inside the file; always
+ * true once jlcdOpen()/jlcdParse() succeeded
+ *  return:
+ *    ERROR_OK                 -- succeed
+ *    ERROR_INVALID_INPUT_FILE -- the span is empty or outside the file
+ */
+int jlcdCheckTile(const JlcdFile *pFile, int tileIndex);
+
+/* get the compressed data of tile `tileIndex`, without copying it. The
+ * span was checked to lie inside the file by jlcdOpen()/jlcdParse() or
+ * jlcdSelectFrame().
+ */
+inline void jlcdGetTile(const JlcdFile *pFile, int tileIndex,
+                        const unsigned char **ppTile, int *pTileSize) {
+  if (pFile->pTileOffsets != NULL) {
+    *ppTile = pFile->pTileData + pFile->pTileOffsets[tileIndex];
+    *pTileSize = pFile->pTileOffsets[tileIndex + 1] -
+                 pFile->pTileOffsets[tileIndex];
+    return;
+  }
+  int tilePosition;
+  const unsigned char *pInfo =
+      pFile->pTileInfos + tileIndex * JLCD_TILE_INFO_SIZE;
+  memcpy(&tilePosition, pInfo, 4);
+  memcpy(pTileSize, pInfo + 4, 4);
+  *ppTile = pFile->pTileData + tilePosition;
+}
+
+#endif
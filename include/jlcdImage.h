@@ -0,0 +1,74 @@
+/* jlcdImage.h
+ *  JLCD images held in memory: encode one from RGBA pixels, re-encode the
+ *  tiles of changed rectangles in place and decode a rectangle
+ */
+#ifndef _JLCDIMAGE_H_
+#define _JLCDIMAGE_H_
+
+#include "jlcdFile.h"
+#include <cstddef>
+#include <vector>
+
+typedef struct _JlcdRect {
+  int x;
+  int y;
+  int width;
+  int height;
+} JlcdRect;
+
+/* encode `pRGBA` (`pitch` bytes from one row to the next, stbi_load()
+ * pixel layout) as a JLCD image of 8x8 tiles into `image`
+ *  nLevel   -- compression level, one of TILE_LEVEL_*
+ *  nVersion -- JLCD format version, 1 (TILE_LEVEL_COMPAT only) or 2
+ *  return:
+ *    ERROR_OK             -- succeed
+ *    ERROR_INVALID_PARAM  -- bad size, level or version
+ */
+int jlcdEncode(std::vector<unsigned char> &image, const unsigned char *pRGBA,
+               ptrdiff_t pitch, int width, int height, int nLevel,
+               int nVersion);
+
+/* re-encode the tiles of `image` that any of the `rectCount` rectangles
+ * touch from `pRGBA`, the whole new frame laid out as for jlcdEncode().
+ * Other tiles are neither encoded nor, in a version 1 image, moved: a new
+ * tile goes where the old one was when it fits and is appended to the
+ * image otherwise, so the image only grows; see jlcdCompact(). A version
+ * 2 image has its tile data rebuilt.
+ *  nLevel -- compression level of the new tiles, one of TILE_LEVEL_*;
+ *            TILE_LEVEL_COMPAT for a version 1 image
+ *  return:
+ *    ERROR_OK                 -- succeed
+ *    ERROR_INVALID_PARAM      -- bad level, or `image` is a sequence
+ *    ERROR_INVALID_INPUT_FILE -- `image` is not a valid JLCD image
+ */
+int jlcdUpdate(std::vector<unsigned char> &image, const unsigned char *pRGBA,
+               ptrdiff_t pitch, const JlcdRect *pRects, int rectCount,
+               int nLevel);
+
+/* drop the tile data of a version 1 image no tile refers to any more,
+ * storing the tiles back to back in index order
+ *  return:
+ *    ERROR_OK                 -- succeed
+ *    ERROR_INVALID_INPUT_FILE -- `image` is not a valid version 1 image
+ */
+int jlcdCompact(std::vector<unsigned char> &image);
+
+/* decode the rectangle `rect` of the selected frame of `pFile` into
+ * `pRGBA`, a `rect.width` x `rect.height` viewport (`pitch` bytes from one
+ * row to the next, stbi_load() pixel layout) whose top left pixel is
+ * (`rect.x`, `rect.y`) of the image. Only the tiles the rectangle touches
+ * are read and decoded, each checked with jlcdCheckTile() first, so a file
+ * from jlcdOpenHeader() will do. Tiles wholly inside are decoded straight
+ * into `pRGBA`, so the whole image as `rect` fills a framebuffer with no
+ * intermediate copy. Pixels of the viewport outside every tile
+ * are set to 0; tiles of size 0, kept from the previous frame of a
+ * sequence, are left as they are.
+ *  return:
+ *    ERROR_OK                 -- succeed
+ *    ERROR_INVALID_PARAM      -- empty rectangle
+ *    ERROR_INVALID_INPUT_FILE -- a tile touched is corrupted
+ */
+int jlcdDecodeRect(const JlcdFile *pFile, const JlcdRect &rect,
+                   unsigned char *pRGBA, ptrdiff_t pitch);
+
+#endif
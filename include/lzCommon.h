@@ -0,0 +1,133 @@
+#ifndef LZ_COMMON_H
+#define LZ_COMMON_H
+
+/// Building blocks shared by the C encoder and the specialized C++ encoders,
+/// kept inline so each of them can be compiled down to straight-line code.
+
+#include <memory.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define MAX_LEN 264
+
+static inline uint32_t lzReadWord(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t lzReadDoubleWord(const uint8_t *p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+/// Index of the first differing byte of two words whose XOR is `diff`.
+static inline uint32_t lzFirstDiffByte(uint64_t diff) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return __builtin_clzll(diff) >> 3;
+#elif defined(__GNUC__)
+  return __builtin_ctzll(diff) >> 3;
+#else
+  uint32_t n = 0;
+  while ((diff & 0xff) == 0) {
+    diff >>= 8;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+/// Count the equal leading bytes of `p1` and `p2`. Never reads `p2` at or
+/// past `bound`; since `p1` is always behind `p2`, it stays in bounds too.
+static inline uint32_t lzMatchLength(const uint8_t *p1, const uint8_t *p2,
+                                     const uint8_t *bound) {
+  const uint8_t *start = p2;
+#if defined(__SSE2__)
+  while (bound - p2 >= 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)p1);
+    __m128i b = _mm_loadu_si128((const __m128i *)p2);
+    uint32_t mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xffff;
+    if (mask) {
+      return p2 - start + __builtin_ctz(mask);
+    }
+    p1 += 16;
+    p2 += 16;
+  }
+#endif
+  while (bound - p2 >= 8) {
+    uint64_t diff = lzReadDoubleWord(p1) ^ lzReadDoubleWord(p2);
+    if (diff) {
+      return p2 - start + lzFirstDiffByte(diff);
+    }
+    p1 += 8;
+    p2 += 8;
+  }
+  while (p2 < bound && *p1 == *p2) {
+    ++p1;
+    ++p2;
+  }
+  return p2 - start;
+}
+
+/// Length of the match at `p1`/`p2` as the token format expects it: the
+/// first mismatching byte is counted, unless `bound` is reached first.
+static inline uint32_t lzCompare(const uint8_t *p1, const uint8_t *p2,
+                                 const uint8_t *bound) {
+  uint32_t skipped = 0;
+  if (lzReadWord(p1) == lzReadWord(p2)) {
+    skipped = 4;
+  }
+  if (p2 + skipped >= bound) {
+    return skipped;
+  }
+  uint32_t remaining = bound - p2;
+  uint32_t length = skipped + lzMatchLength(p1 + skipped, p2 + skipped, bound);
+  return length < remaining ? length + 1 : remaining;
+}
+
+/// Write `runs` literals from `src` to `op`; returns the new end of output.
+static inline uint8_t *lzDumpLiterals(uint8_t *op, uint32_t runs,
+                                      const uint8_t *src) {
+  while (runs >= 32) {
+    *op++ = 31;
+    memcpy(op, src, 32);
+    op += 32;
+    runs -= 32;
+    src += 32;
+  }
+  if (runs > 0) {
+    *op++ = runs - 1;
+    memcpy(op, src, runs);
+    op += runs;
+  }
+  return op;
+}
+
+/// Write a match token to `op`; returns the new end of output.
+static inline uint8_t *lzDumpMatch(uint8_t *op, uint32_t length,
+                                   uint32_t distance) {
+  --distance;
+  if (length > MAX_LEN - 2) {
+    while (length > MAX_LEN - 2) {
+      *op++ = (7 << 5) + (distance >> 8);
+      *op++ = MAX_LEN - 2 - 7 - 2;
+      *op++ = (distance & 255);
+      length -= MAX_LEN - 2;
+    }
+  }
+  if (length < 7) {
+    *op++ = (length << 5) + (distance >> 8);
+    *op++ = (distance & 255);
+  } else {
+    *op++ = (7 << 5) + (distance >> 8);
+    *op++ = length - 7;
+    *op++ = (distance & 255);
+  }
+  return op;
+}
+
+#endif // LZ_COMMON_H
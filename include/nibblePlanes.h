@@ -0,0 +1,31 @@
+/* nibblePlanes.h
+ *  nibble-plane transform used before encoding and after decoding a tile
+ */
+#ifndef _NIBBLEPLANES_H_
+#define _NIBBLEPLANES_H_
+
+#include <cstddef>
+
+/* split `nBytes` bytes into two nibble planes: the first half of `pPlanes`
+ * gets the low nibble of each even byte in its high bits and the low nibble
+ * of the following odd byte in its low bits, the second half the high
+ * nibbles in the same order. `nBytes` must be even.
+ */
+void splitNibbles(const unsigned char *pClrBlk, unsigned char *pPlanes,
+                  int nBytes);
+
+/* inverse of splitNibbles */
+void mergeNibbles(const unsigned char *pPlanes, unsigned char *pClrBlk,
+                  int nBytes);
+
+/* same as mergeNibbles, storing the bytes as rows of `rowBytes` that start
+ * `pitch` bytes apart at `pDst`; rows of 32 bytes take one 32 byte store
+ * each with AVX2. `nBytes` must be a multiple of `rowBytes`.
+ */
+void mergeNibblesToRows(const unsigned char *pPlanes, unsigned char *pDst,
+                        ptrdiff_t pitch, int rowBytes, int nBytes);
+
+/* name of the kernel set picked for this CPU: "avx2", "sse2" or "scalar" */
+const char *nibblePlanesKernelName();
+
+#endif
@@ -4,8 +4,94 @@
 #ifndef _RGBTILEPROC_H_
 #define _RGBTILEPROC_H_
 
+#include "encode.h"
+#include <cstddef>
+
+// largest tile the codec handles (16x16 ARGB), so that per-tile scratch
+// buffers can live on the stack
+#define TILE_MAX_BYTES (16 * 16 * 4)
+
+/* compression levels, all decodable by tile2argb()
+ *  COMPAT  -- the original encoder, output identical to encode()
+ *  FAST    -- greedy, skipping ahead faster the longer no match is found
+ *  GREEDY  -- greedy, first hash hit wins
+ *  LAZY    -- a match is deferred by one byte if that gives a longer one,
+ *             and matches may run up to the end of the tile
+ *  OPTIMAL -- shortest output over all matches the hash table offers
+ * All levels but COMPAT use the compact multiplicative hash table, store a
+ * tile of one ARGB value as that value (see uniformTile.h) and a tile that
+ * does not compress as is (see TILE_STORED_MARKER); LAZY and OPTIMAL keep
+ * several positions per slot and take the longest match. Only COMPAT
+ * output is a plain token stream that the original decode() reads, so the
+ * other levels must not go into version 1 JLCD files (see jlcdFile.h).
+ */
+#define TILE_LEVEL_COMPAT 0
+#define TILE_LEVEL_FAST 1
+#define TILE_LEVEL_GREEDY 2
+#define TILE_LEVEL_LAZY 3
+#define TILE_LEVEL_OPTIMAL 4
+
+/* first byte of a tile that did not compress, followed by its raw ARGB
+ * data. Token streams start with a literal run header, which is below 32;
+ * decoders that predate it do not know the marker, see jlcdFile.h.
+ */
+#define TILE_STORED_MARKER 0xff
+
+class TileEncoderBase;
+
+/* tile geometry plus the encoder state for one thread. Nothing in it is
+ * global, so codecs with different geometries can be used side by side.
+ */
+typedef struct _TileCodec {
+  int nTileWidth;
+  int nTileHeight;
+  int nLevel;
+  EncodeContext *pEncodeContext;
+  // encoder specialized for this geometry (see tileEncoder.h), NULL when
+  // there is none and pEncodeContext is used instead
+  TileEncoderBase *pTileEncoder;
+} TileCodec;
+
+/* create a codec for `nTileWidth` x `nTileHeight` tiles
+ *  return:
+ *    NULL if the geometry is empty or larger than TILE_MAX_BYTES
+ */
+TileCodec *tileCodecInit(int nTileWidth, int nTileHeight);
+/* same as tileCodecInit, encoding at `nLevel` (one of TILE_LEVEL_*). Tile
+ * geometries without a specialized encoder fall back to the greedy parse.
+ *  return:
+ *    NULL if the geometry or the level is invalid
+ */
+TileCodec *tileCodecInitLevel(int nTileWidth, int nTileHeight, int nLevel);
+void tileCodecFree(TileCodec *pCodec);
+
+/* same as argb2tile, with the geometry and encoder state of `pCodec` */
+int argb2tileWithCodec(TileCodec *pCodec, const unsigned char *pClrBlk,
+                       unsigned char *pTile, int *pTileSize);
+
+/* same as tile2argb, with the geometry of `pCodec` */
+int tile2argbWithCodec(const TileCodec *pCodec, const unsigned char *pTile,
+                       int nTileSize, unsigned char *pClrBlk);
+
+/* same as tile2argbWithCodec, writing pixel row i of the tile straight to
+ * `pDst` + i * `pitch` of a framebuffer, with no intermediate copy.
+ * Nothing is written for a corrupted tile.
+ */
+int tile2argbToRows(const TileCodec *pCodec, const unsigned char *pTile,
+                    int nTileSize, unsigned char *pDst, ptrdiff_t pitch);
+
+/* set the geometry used by argb2tile and tile2argb. Prefer a TileCodec
+ * when several threads or geometries are involved. Both fail on tiles
+ * larger than TILE_MAX_BYTES.
+ */
 void tileSetSize(int nTileWidth, int nTileHeight);
 
+/* most bytes argb2tile and argb2tileWithCodec write for one tile at
+ * `nLevel` (TILE_LEVEL_COMPAT for argb2tile), so output buffers can be
+ * sized up front
+ */
+int tileEncodeBound(int nTileWidth, int nTileHeight, int nLevel);
+
 /* compress ARGB data to tile
  *  param:
  *    pClrBlk      -- IN, pixel's ARGB data
@@ -18,7 +104,7 @@ void tileSetSize(int nTileWidth, int nTileHeight);
 int argb2tile(const unsigned char *pClrBlk, unsigned char *pTile,
               int *pTileSize);
 
-/* decompress tile data to ARGB
+/* decompress tile data to ARGB, 8x8 unless tileSetSize() was called
  *  param:
  *    pTile        -- IN, tile data
  *    pTileSize    -- IN, tile's bytes
@@ -0,0 +1,25 @@
+/* tileCompare.h
+ *  equality of a tile in two images of one layout, used to find the tiles
+ *  a frame shares with the previous one, and a hash of tile contents to
+ *  find repeated tiles
+ */
+#ifndef _TILECOMPARE_H_
+#define _TILECOMPARE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/* return:
+ *    1  -- the `rows` rows of `rowBytes` bytes at `pA` and at `pB`, each
+ *          `pitch` bytes after the last, are equal
+ *    0  -- otherwise
+ */
+int tileEqual(const unsigned char *pA, const unsigned char *pB,
+              ptrdiff_t pitch, int rowBytes, int rows);
+
+/* 64-bit hash of `nBytes` bytes, in four independent multiply-rotate
+ * lanes of 8 bytes; equal hashes still need a full compare
+ */
+uint64_t tileHash64(const unsigned char *pData, int nBytes);
+
+#endif
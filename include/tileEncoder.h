@@ -0,0 +1,415 @@
+/* tileEncoder.h
+ *  encoder kernels specialized at compile time for one tile geometry and
+ *  hash table layout
+ */
+#ifndef _TILEENCODER_H_
+#define _TILEENCODER_H_
+
+#include "lzCommon.h"
+#include "rgbTileProc.h"
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/* common interface, so a TileCodec can hold any specialization */
+class TileEncoderBase {
+public:
+  virtual ~TileEncoderBase() {}
+  /* encode one tile of nibble planes; returns the encoded size */
+  virtual int encode(const uint8_t *pPlanes, uint8_t *pTile) = 0;
+};
+
+/* at TILE_LEVEL_COMPAT and TILE_LEVEL_GREEDY the same parse and output as
+ * the C `encode()` with the matching hash table, but with the input size,
+ * limits and hash mask as constants and no function pointers. The other
+ * levels parse differently, see rgbTileProc.h.
+ *  kCompact -- false: uint32 entries and HashTable_normalHashFunc, like
+ *              EncodeContext_init()
+ *              true: uint16 entries and HashTable_multiplyHashFunc, like
+ *              EncodeContext_initCompact()
+ *  kWays    -- positions kept per hash slot, most recent first. Only the
+ *              lazy and optimal parses look past the first one.
+ */
+template <int kTileWidth, int kTileHeight, int kHashBits, bool kCompact,
+          int kWays = 1>
+class TileEncoder final : public TileEncoderBase {
+public:
+  static constexpr uint32_t kInputSize = kTileWidth * kTileHeight * 4;
+  static constexpr uint32_t kTableSize = 1u << kHashBits;
+  typedef typename std::conditional<kCompact, uint16_t, uint32_t>::type Entry;
+  static constexpr uint32_t kEntryMax = kCompact ? UINT16_MAX : UINT32_MAX;
+  static_assert(kInputSize > 13, "tile too small to encode");
+  static_assert(2 * kInputSize <= kEntryMax - kInputSize,
+                "positions do not fit the table entries");
+
+  /*  depth -- entries of a slot searched for the longest match, at most
+   *           kWays
+   */
+  explicit TileEncoder(int level = TILE_LEVEL_COMPAT, int depth = kWays)
+      : base_(0), level_(level), depth_(depth < kWays ? depth : kWays) {
+    memset(table_, 0, sizeof(table_));
+  }
+
+  int encode(const uint8_t *pPlanes, uint8_t *pTile) override {
+    uint8_t *op;
+    switch (level_) {
+    case TILE_LEVEL_FAST:
+      op = encodeFast(pPlanes, pTile);
+      break;
+    case TILE_LEVEL_LAZY:
+      op = encodeLazy(pPlanes, pTile);
+      break;
+    case TILE_LEVEL_OPTIMAL:
+      op = encodeOptimal(pPlanes, pTile);
+      break;
+    default: // TILE_LEVEL_COMPAT, TILE_LEVEL_GREEDY
+      op = encodeBlock(pPlanes, pTile);
+      break;
+    }
+    // forget this tile's positions, see HashTable_invalidate()
+    if (base_ > kEntryMax - 2 * kInputSize) {
+      memset(table_, 0, sizeof(table_));
+      base_ = 0;
+    } else {
+      base_ += kInputSize;
+    }
+    return op - pTile;
+  }
+
+private:
+  static uint32_t hash(uint32_t key) {
+    if (kCompact) {
+      return (key * 2654435761u) >> (32 - kHashBits);
+    }
+    return ((key ^ 0x9E3779B9) >> (32 - kHashBits)) & (kTableSize - 1);
+  }
+
+  uint32_t get(uint32_t slot) const {
+    uint32_t entry = table_[slot * kWays];
+    return entry >= base_ ? entry - base_ : 0;
+  }
+
+  void set(uint32_t slot, uint32_t position) {
+    Entry *bucket = table_ + slot * kWays;
+    // the oldest entry drops out
+    for (int way = kWays - 1; way > 0; way--) {
+      bucket[way] = bucket[way - 1];
+    }
+    bucket[0] = static_cast<Entry>(base_ + position);
+  }
+
+  uint8_t *encodeBlock(const uint8_t *start, uint8_t *op) {
+    const uint8_t *const end = start + kInputSize;
+    const uint8_t *const limit = end - 13;
+    const uint8_t *anchor = start;
+    const uint8_t *ip = start + 2;
+
+    while (ip < limit) {
+      const uint8_t *ref;
+      uint32_t distance;
+
+      uint32_t seq;
+      do {
+        seq = lzReadWord(ip) & 0xffffff;
+        uint32_t slot = hash(seq);
+        ref = start + get(slot);
+        set(slot, ip - start);
+        distance = ip - ref;
+
+        if (ip >= limit) {
+          break;
+        }
+        ++ip;
+      } while (seq != (lzReadWord(ref) & 0xffffff));
+
+      if (ip >= limit) {
+        break;
+      }
+      --ip;
+
+      if (ip > anchor) {
+        op = lzDumpLiterals(op, ip - anchor, anchor);
+      }
+
+      uint32_t length = lzCompare(ref + 3, ip + 3, end - 4);
+      op = lzDumpMatch(op, length, distance);
+
+      ip += length;
+      seq = lzReadWord(ip);
+      set(hash(seq & 0xffffff), ip++ - start);
+      seq >>= 8;
+      set(hash(seq), ip++ - start);
+
+      anchor = ip;
+    }
+
+    return lzDumpLiterals(op, end - anchor, anchor);
+  }
+
+  /* the table entry of the 3 bytes at `ip` if those bytes are equal, NULL
+   * otherwise
+   */
+  const uint8_t *find(const uint8_t *start, const uint8_t *ip) const {
+    uint32_t seq = lzReadWord(ip) & 0xffffff;
+    const uint8_t *ref = start + get(hash(seq));
+    return ref < ip && seq == (lzReadWord(ref) & 0xffffff) ? ref : NULL;
+  }
+
+  void insert(const uint8_t *start, const uint8_t *ip) {
+    set(hash(lzReadWord(ip) & 0xffffff), ip - start);
+  }
+
+  /* same as find(), then make `ip` the table entry */
+  const uint8_t *findAndInsert(const uint8_t *start, const uint8_t *ip) {
+    const uint8_t *ref = find(start, ip);
+    insert(start, ip);
+    return ref;
+  }
+
+  /* matches for `ip` among the first depth_ entries of its slot, most
+   * recent first; `pCovers` gets the bytes each one covers up to `end`.
+   * Returns the number of matches.
+   */
+  int findMatches(const uint8_t *start, const uint8_t *ip,
+                  const uint8_t *end, const uint8_t **pRefs,
+                  uint32_t *pCovers) const {
+    uint32_t seq = lzReadWord(ip) & 0xffffff;
+    const Entry *bucket = table_ + hash(seq) * kWays;
+    int count = 0;
+    for (int way = 0; way < depth_; way++) {
+      if (bucket[way] < base_) {
+        break; // from an earlier tile, and so are the ones after it
+      }
+      const uint8_t *ref = start + (bucket[way] - base_);
+      if (ref < ip && seq == (lzReadWord(ref) & 0xffffff)) {
+        pRefs[count] = ref;
+        pCovers[count] = 3 + lzMatchLength(ref + 3, ip + 3, end);
+        count++;
+      }
+    }
+    return count;
+  }
+
+  /* the longest of findMatches(), the most recent one on ties; returns
+   * the bytes it covers, 0 (and a null `*pRef`) if there is no match
+   */
+  uint32_t findLongest(const uint8_t *start, const uint8_t *ip,
+                       const uint8_t *end, const uint8_t **pRef) const {
+    const uint8_t *refs[kWays];
+    uint32_t covers[kWays];
+    int count = findMatches(start, ip, end, refs, covers);
+    uint32_t longest = 0;
+    *pRef = nullptr;
+    for (int i = 0; i < count; i++) {
+      if (covers[i] > longest) {
+        longest = covers[i];
+        *pRef = refs[i];
+      }
+    }
+    return longest;
+  }
+
+  uint8_t *encodeFast(const uint8_t *start, uint8_t *op) {
+    // one more byte of step for every 8 probes without a match
+    const int kSkipShift = 3;
+    const uint8_t *const end = start + kInputSize;
+    const uint8_t *const limit = end - 13;
+    const uint8_t *anchor = start;
+    const uint8_t *ip = start + 2;
+
+    while (ip < limit) {
+      const uint8_t *ref;
+      uint32_t misses = 0;
+      while ((ref = findAndInsert(start, ip)) == NULL) {
+        ip += 1 + (misses++ >> kSkipShift);
+        if (ip >= limit) {
+          return lzDumpLiterals(op, end - anchor, anchor);
+        }
+      }
+
+      if (ip > anchor) {
+        op = lzDumpLiterals(op, ip - anchor, anchor);
+      }
+      uint32_t length = lzCompare(ref + 3, ip + 3, end - 4);
+      op = lzDumpMatch(op, length, ip - ref);
+
+      ip += length;
+      findAndInsert(start, ip++);
+      findAndInsert(start, ip++);
+      anchor = ip;
+    }
+
+    return lzDumpLiterals(op, end - anchor, anchor);
+  }
+
+  uint8_t *encodeLazy(const uint8_t *start, uint8_t *op) {
+    // unlike encodeBlock(), matches may run up to the last byte
+    const uint8_t *const end = start + kInputSize;
+    const uint8_t *const limit = end - 4;
+    const uint8_t *anchor = start;
+    const uint8_t *ip = start;
+
+    while (ip < limit) {
+      const uint8_t *ref;
+      uint32_t cover = findLongest(start, ip, end, &ref);
+      insert(start, ip);
+      if (cover == 0) {
+        ++ip;
+        continue;
+      }
+
+      // take the match one byte later if it outweighs the extra literal
+      if (ip + 1 < limit) {
+        const uint8_t *next;
+        uint32_t nextCover = findLongest(start, ip + 1, end, &next);
+        if (nextCover > cover + 1) {
+          ++ip;
+          ref = next;
+          cover = nextCover;
+        }
+      }
+
+      if (ip > anchor) {
+        op = lzDumpLiterals(op, ip - anchor, anchor);
+      }
+      op = lzDumpMatch(op, cover - 2, ip - ref);
+
+      const uint8_t *matchEnd = ip + cover;
+      for (ip = matchEnd - 2; ip < matchEnd && ip < limit; ++ip) {
+        findAndInsert(start, ip);
+      }
+      ip = matchEnd;
+      anchor = ip;
+    }
+
+    return lzDumpLiterals(op, end - anchor, anchor);
+  }
+
+  /* bytes lzDumpMatch() writes for a match covering `cover` bytes */
+  static uint32_t matchCost(uint32_t cover) {
+    uint32_t length = cover - 2;
+    uint32_t cost = 0;
+    while (length > MAX_LEN - 2) {
+      cost += 3;
+      length -= MAX_LEN - 2;
+    }
+    return cost + (length < 7 ? 2 : 3);
+  }
+
+  static void relax(uint32_t *cost, uint16_t *cover, uint16_t *distance,
+                    uint16_t *run, uint32_t i, uint32_t length,
+                    uint32_t matchDistance) {
+    uint32_t matchTotal = cost[i] + matchCost(length);
+    if (matchTotal < cost[i + length]) {
+      cost[i + length] = matchTotal;
+      cover[i + length] = length;
+      distance[i + length] = matchDistance;
+      run[i + length] = 0;
+    }
+  }
+
+  uint8_t *encodeOptimal(const uint8_t *start, uint8_t *op) {
+    const uint8_t *const end = start + kInputSize;
+    const uint32_t kMinMatch = 3;
+    // matches at least this long are taken without trying shorter ones
+    const uint32_t kSufficientLength = 32;
+    // cost[i]: fewest bytes that encode start[0, i); the step into i is a
+    // match of `cover[i]` bytes from `distance[i]` back, or a literal when
+    // cover[i] is 0. `run[i]` is the literal run ending at i, which decides
+    // whether the next literal needs a new run header.
+    uint32_t cost[kInputSize + 1];
+    uint16_t cover[kInputSize + 1];
+    uint16_t distance[kInputSize + 1];
+    uint16_t run[kInputSize + 1];
+
+    cost[0] = 0;
+    run[0] = 0;
+    for (uint32_t i = 1; i <= kInputSize; i++) {
+      cost[i] = UINT32_MAX;
+    }
+
+    for (uint32_t i = 0; i < kInputSize; i++) {
+      uint32_t literalCost = cost[i] + 1 + (run[i] % 32 == 0 ? 1 : 0);
+      if (literalCost < cost[i + 1]) {
+        cost[i + 1] = literalCost;
+        cover[i + 1] = 0;
+        run[i + 1] = run[i] + 1;
+      }
+
+      if (i + 4 > kInputSize) {
+        continue;
+      }
+      const uint8_t *refs[kWays];
+      uint32_t covers[kWays];
+      int count = findMatches(start, start + i, end, refs, covers);
+      insert(start, start + i);
+
+      int longest = -1;
+      for (int c = 0; c < count; c++) {
+        if (longest < 0 || covers[c] > covers[longest]) {
+          longest = c;
+        }
+      }
+      if (longest >= 0 && covers[longest] >= kSufficientLength) {
+        // long enough to take as is; only hash the positions it covers
+        uint32_t length = covers[longest];
+        const uint8_t *ref = refs[longest];
+        relax(cost, cover, distance, run, i, length, start + i - ref);
+        for (uint32_t j = i + 1; j < i + length && j + 4 <= kInputSize;
+             j++) {
+          insert(start, start + j);
+        }
+        i += length - 1;
+        continue;
+      }
+      // the cost does not depend on the distance, so every length goes to
+      // the most recent match that reaches it
+      uint32_t reached = kMinMatch - 1;
+      for (int c = 0; c < count; c++) {
+        for (uint32_t length = reached + 1; length <= covers[c]; length++) {
+          relax(cost, cover, distance, run, i, length, start + i - refs[c]);
+        }
+        if (covers[c] > reached) {
+          reached = covers[c];
+        }
+      }
+    }
+
+    // walk back to collect the steps, then emit them front to back
+    uint16_t steps[kInputSize];
+    int stepCount = 0;
+    for (uint32_t i = kInputSize; i > 0;) {
+      steps[stepCount++] = i;
+      i -= cover[i] ? cover[i] : 1;
+    }
+    const uint8_t *anchor = start;
+    while (stepCount > 0) {
+      uint32_t i = steps[--stepCount];
+      if (cover[i] == 0) {
+        continue;
+      }
+      const uint8_t *ip = start + i - cover[i];
+      if (ip > anchor) {
+        op = lzDumpLiterals(op, ip - anchor, anchor);
+      }
+      op = lzDumpMatch(op, cover[i] - 2, distance[i]);
+      anchor = start + i;
+    }
+    return lzDumpLiterals(op, start + kInputSize - anchor, anchor);
+  }
+
+  Entry table_[kTableSize * kWays];
+  uint32_t base_;
+  int level_;
+  int depth_;
+};
+
+/* the specialization for a geometry, or NULL when there is none and the
+ * generic C encoder has to be used. Built for 8x8, 16x16 and 8x16.
+ *  level -- one of TILE_LEVEL_*
+ */
+TileEncoderBase *createTileEncoder(int nTileWidth, int nTileHeight,
+                                   bool compact,
+                                   int level = TILE_LEVEL_COMPAT);
+
+#endif
@@ -0,0 +1,21 @@
+/* uniformTile.h
+ *  tiles whose pixels all have one ARGB value. The encoder stores such a
+ *  tile as that value alone, UNIFORM_TILE_SIZE bytes, which no token
+ *  stream is as short as.
+ */
+#ifndef _UNIFORMTILE_H_
+#define _UNIFORMTILE_H_
+
+#define UNIFORM_TILE_SIZE 4
+
+/* return:
+ *    1  -- all `nBytes` / 4 pixels of `pClrBlk` are equal
+ *    0  -- otherwise
+ */
+int tileIsUniform(const unsigned char *pClrBlk, int nBytes);
+
+/* write the pixel `pPixel` (UNIFORM_TILE_SIZE bytes) `nBytes` / 4 times */
+void tileFillUniform(unsigned char *pClrBlk, const unsigned char *pPixel,
+                     int nBytes);
+
+#endif
@@ -0,0 +1,428 @@
+/* bmpFile.cpp
+ *  strip-wise reading of uncompressed 24 and 32 bit BMP files and writing
+ *  of 32 bit ones, mapped where the platform allows
+ */
+#include "bmpFile.h"
+#include "defines.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BMP_FILE_X86 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define BMP_USE_MMAP 1
+#endif
+
+// the largest header read: file header, BITMAPV5HEADER
+#define BMP_FILE_HEADER_SIZE 14
+#define BMP_MAX_HEADER_SIZE (BMP_FILE_HEADER_SIZE + 124)
+#define BMP_MAX_DIMENSION (1 << 24)
+
+#define BI_RGB 0
+#define BI_BITFIELDS 3
+
+// what bmpWrite() writes: file header, BITMAPV4HEADER
+#define BMP_V4_HEADER_SIZE 108
+#define BMP_WRITE_DATA_OFFSET (BMP_FILE_HEADER_SIZE + BMP_V4_HEADER_SIZE)
+// bytes converted per fwrite() by bmpWrite()
+#define BMP_WRITE_CHUNK (256 * 1024)
+
+static uint32_t readU32(const unsigned char *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t readU16(const unsigned char *p) { return p[0] | p[1] << 8; }
+
+static void writeU32(unsigned char *p, uint32_t value) {
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+
+/* the headers of a bottom-up 32 bit BI_BITFIELDS image, field for field
+ * as stbi_write_bmp() writes them; unset fields are zero
+ */
+static void fillHeader(unsigned char *pHeader, int width, int height) {
+  memset(pHeader, 0, BMP_WRITE_DATA_OFFSET);
+  pHeader[0] = 'B';
+  pHeader[1] = 'M';
+  writeU32(pHeader + 2,
+           BMP_WRITE_DATA_OFFSET + (uint32_t)width * height * 4);
+  writeU32(pHeader + 10, BMP_WRITE_DATA_OFFSET);
+  writeU32(pHeader + 14, BMP_V4_HEADER_SIZE);
+  writeU32(pHeader + 18, width);
+  writeU32(pHeader + 22, height);
+  pHeader[26] = 1;  // planes
+  pHeader[28] = 32; // bits per pixel
+  writeU32(pHeader + 30, BI_BITFIELDS);
+  writeU32(pHeader + 54, 0x00ff0000);
+  writeU32(pHeader + 58, 0x0000ff00);
+  writeU32(pHeader + 62, 0x000000ff);
+  writeU32(pHeader + 66, 0xff000000);
+}
+
+/* file rows [fileRow, fileRow + rowCount), straight from the mapping or
+ * read into pFile->pStrip; NULL when the read fails
+ */
+static const unsigned char *fileRows(BmpFile *pFile, int fileRow,
+                                     int rowCount) {
+  size_t offset = pFile->dataOffset + (size_t)fileRow * pFile->rowStride;
+  if (pFile->pFileData != NULL) {
+    return pFile->pFileData + offset;
+  }
+  if (rowCount > pFile->stripCapacity) {
+    free(pFile->pStrip);
+    pFile->pStrip = static_cast<unsigned char *>(
+        malloc((size_t)rowCount * pFile->rowStride));
+    pFile->stripCapacity = pFile->pStrip != NULL ? rowCount : 0;
+    if (pFile->pStrip == NULL) {
+      return NULL;
+    }
+  }
+  size_t bytes = (size_t)rowCount * pFile->rowStride;
+  if (fseek(pFile->fp, (long)offset, SEEK_SET) != 0 ||
+      fread(pFile->pStrip, 1, bytes, pFile->fp) != bytes) {
+    return NULL;
+  }
+  return pFile->pStrip;
+}
+
+/* stbi_load() turns an alpha channel of zeros into 255, which needs the
+ * whole image; stop at the first pixel that is not transparent
+ */
+static int isAlphaAllZero(BmpFile *pFile) {
+  const int STRIP_ROWS = 8;
+  for (int row = 0; row < pFile->height; row += STRIP_ROWS) {
+    int rowCount = pFile->height - row < STRIP_ROWS ? pFile->height - row
+                                                    : STRIP_ROWS;
+    const unsigned char *pRows = fileRows(pFile, row, rowCount);
+    if (pRows == NULL) {
+      return 0;
+    }
+    for (int i = 0; i < rowCount; i++) {
+      const unsigned char *pRow = pRows + (size_t)i * pFile->rowStride;
+      for (int x = 0; x < pFile->width; x++) {
+        if (pRow[x * 4 + 3] != 0) {
+          return 0;
+        }
+      }
+    }
+  }
+  return 1;
+}
+
+int bmpOpen(BmpFile *pFile, char const *fileName) {
+  memset(pFile, 0, sizeof(BmpFile));
+  pFile->fp = fopen(fileName, "rb");
+  if (pFile->fp == NULL) {
+    return ERROR_INPUT_FILE;
+  }
+
+  unsigned char header[BMP_MAX_HEADER_SIZE + 12] = {0};
+  size_t headerBytes = fread(header, 1, sizeof(header), pFile->fp);
+  if (headerBytes < BMP_FILE_HEADER_SIZE + 40 || header[0] != 'B' ||
+      header[1] != 'M') {
+    bmpClose(pFile);
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  uint32_t dataOffset = readU32(header + 10);
+  uint32_t headerSize = readU32(header + 14);
+  int32_t width = (int32_t)readU32(header + 18);
+  int32_t height = (int32_t)readU32(header + 22);
+  uint16_t planes = readU16(header + 26);
+  uint16_t bitsPerPixel = readU16(header + 28);
+  uint32_t compression = readU32(header + 30);
+
+  // the layouts stbi_load() reads as plain 8 bit BGR(A); V3 headers (56)
+  // and pixels not right after the headers are left to it, it reads
+  // those from unusual places
+  size_t headerEnd = BMP_FILE_HEADER_SIZE + headerSize;
+  uint32_t maskR = 0x00ff0000, maskG = 0x0000ff00, maskB = 0x000000ff;
+  uint32_t maskA = 0xff000000;
+  if ((headerSize != 40 && headerSize != 108 && headerSize != 124) ||
+      headerBytes < headerEnd || planes != 1 || width <= 0 || height == 0 ||
+      width > BMP_MAX_DIMENSION || height > BMP_MAX_DIMENSION ||
+      height < -BMP_MAX_DIMENSION) {
+    bmpClose(pFile);
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  if (bitsPerPixel == 24 && compression == BI_RGB) {
+    pFile->hasAlpha = 0;
+  } else if (bitsPerPixel == 32 && compression == BI_RGB) {
+    pFile->hasAlpha = 1;
+    pFile->forceOpaque = 1; // unless a pixel says otherwise, see below
+  } else if (bitsPerPixel == 32 && compression == BI_BITFIELDS) {
+    maskR = readU32(header + 54);
+    maskG = readU32(header + 58);
+    maskB = readU32(header + 62);
+    if (headerSize == 40) {
+      maskA = 0;
+      headerEnd += 12;
+    } else {
+      maskA = readU32(header + 66);
+    }
+    pFile->hasAlpha = maskA != 0;
+  } else {
+    bmpClose(pFile);
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  if (maskR != 0x00ff0000 || maskG != 0x0000ff00 || maskB != 0x000000ff ||
+      (maskA != 0xff000000 && maskA != 0) || dataOffset != headerEnd) {
+    bmpClose(pFile);
+    return ERROR_INVALID_INPUT_FILE;
+  }
+
+  pFile->width = width;
+  pFile->height = height < 0 ? -height : height;
+  pFile->topDown = height < 0;
+  pFile->bitsPerPixel = bitsPerPixel;
+  pFile->channels = pFile->hasAlpha ? 4 : 3;
+  pFile->dataOffset = dataOffset;
+  pFile->rowStride = (width * (bitsPerPixel / 8) + 3) & ~3;
+
+  // stbi_load() reads zeros past the end; only complete files stream
+  long fileSize = -1;
+  if (fseek(pFile->fp, 0, SEEK_END) == 0) {
+    fileSize = ftell(pFile->fp);
+  }
+  if (fileSize < (long)dataOffset + (long)pFile->rowStride * pFile->height) {
+    bmpClose(pFile);
+    return ERROR_INVALID_INPUT_FILE;
+  }
+#ifdef BMP_USE_MMAP
+  void *pMapped =
+      mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fileno(pFile->fp), 0);
+  if (pMapped != MAP_FAILED) {
+    pFile->pFileData = static_cast<unsigned char *>(pMapped);
+    pFile->fileSize = fileSize;
+    fclose(pFile->fp);
+    pFile->fp = NULL;
+  }
+#endif
+  if (pFile->forceOpaque) {
+    pFile->forceOpaque = isAlphaAllZero(pFile);
+  }
+  return ERROR_OK;
+}
+
+int bmpReadRows(BmpFile *pFile, int firstRow, int rowCount,
+                unsigned char *pRGBA) {
+  // the strip is one block of the file, top first or bottom first
+  int fileRow =
+      pFile->topDown ? firstRow : pFile->height - firstRow - rowCount;
+  const unsigned char *pRows = fileRows(pFile, fileRow, rowCount);
+  if (pRows == NULL) {
+    return ERROR_INPUT_FILE;
+  }
+  const int bytesPerPixel = pFile->bitsPerPixel / 8;
+  for (int i = 0; i < rowCount; i++) {
+    const unsigned char *pRow =
+        pRows + (size_t)(pFile->topDown ? i : rowCount - 1 - i) *
+                    pFile->rowStride;
+    unsigned char *pOut = pRGBA + (size_t)i * pFile->width * 4;
+    if (bytesPerPixel == 4) {
+      bmpPixelsToRGBA(pRow, pOut, pFile->width,
+                      !pFile->hasAlpha || pFile->forceOpaque);
+      continue;
+    }
+    for (int x = 0; x < pFile->width; x++) {
+      const unsigned char *pPixel = pRow + x * bytesPerPixel;
+      pOut[0] = pPixel[2];
+      pOut[1] = pPixel[1];
+      pOut[2] = pPixel[0];
+      pOut[3] = 255;
+      pOut += 4;
+    }
+  }
+  return ERROR_OK;
+}
+
+int bmpWriteFits(int width, int height) {
+  return width > 0 && height > 0 &&
+         (uint64_t)width * height * 4 <= UINT32_MAX - BMP_WRITE_DATA_OFFSET;
+}
+
+int bmpWrite(char const *fileName, int width, int height,
+             const unsigned char *pRGBA) {
+  FILE *fp = fopen(fileName, "wb");
+  if (fp == NULL) {
+    return ERROR_OUTPUT_FILE;
+  }
+  unsigned char header[BMP_WRITE_DATA_OFFSET];
+  fillHeader(header, width, height);
+  int ret = fwrite(header, 1, sizeof(header), fp) == sizeof(header)
+                ? ERROR_OK
+                : ERROR_OUTPUT_FILE;
+
+  // bottom row first, a chunk of rows per write
+  size_t rowBytes = (size_t)width * 4;
+  int chunkRows = rowBytes < BMP_WRITE_CHUNK ? BMP_WRITE_CHUNK / rowBytes : 1;
+  unsigned char *pChunk =
+      static_cast<unsigned char *>(malloc(chunkRows * rowBytes));
+  if (pChunk == NULL) {
+    ret = ERROR_OUTPUT_FILE;
+  }
+  for (int row = height; ret == ERROR_OK && row > 0; row -= chunkRows) {
+    int rowCount = row < chunkRows ? row : chunkRows;
+    for (int i = 0; i < rowCount; i++) {
+      bmpPixelsToRGBA(pRGBA + (size_t)(row - 1 - i) * rowBytes,
+                      pChunk + i * rowBytes, width, 0);
+    }
+    if (fwrite(pChunk, rowBytes, rowCount, fp) != (size_t)rowCount) {
+      ret = ERROR_OUTPUT_FILE;
+    }
+  }
+  free(pChunk);
+  if (fclose(fp) != 0) {
+    ret = ERROR_OUTPUT_FILE;
+  }
+  return ret;
+}
+
+int bmpCreate(BmpFile *pFile, char const *fileName, int width, int height) {
+  memset(pFile, 0, sizeof(BmpFile));
+#ifdef BMP_USE_MMAP
+  size_t fileSize = BMP_WRITE_DATA_OFFSET + (size_t)width * height * 4;
+  int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return ERROR_OUTPUT_FILE;
+  }
+  void *pMapped = MAP_FAILED;
+  if (ftruncate(fd, fileSize) == 0) {
+    pMapped = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (pMapped == MAP_FAILED) {
+    return ERROR_OUTPUT_FILE;
+  }
+  pFile->pFileData = static_cast<unsigned char *>(pMapped);
+  pFile->fileSize = fileSize;
+  fillHeader(pFile->pFileData, width, height);
+  pFile->width = width;
+  pFile->height = height;
+  pFile->channels = 4;
+  pFile->dataOffset = BMP_WRITE_DATA_OFFSET;
+  pFile->bitsPerPixel = 32;
+  pFile->rowStride = width * 4;
+  pFile->hasAlpha = 1;
+  return ERROR_OK;
+#else
+  (void)fileName;
+  (void)width;
+  (void)height;
+  return ERROR_OUTPUT_FILE;
+#endif
+}
+
+void bmpReleaseRows(BmpFile *pFile, int firstRow, int rowCount) {
+#ifdef BMP_USE_MMAP
+  if (pFile->pFileData == NULL) {
+    return;
+  }
+  int fileRow =
+      pFile->topDown ? firstRow : pFile->height - firstRow - rowCount;
+  // whole pages only; the ones shared with other rows stay
+  uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = (uintptr_t)(pFile->pFileData + pFile->dataOffset +
+                                (size_t)fileRow * pFile->rowStride);
+  uintptr_t end = begin + (size_t)rowCount * pFile->rowStride;
+  begin = (begin + pageSize - 1) & ~(pageSize - 1);
+  end &= ~(pageSize - 1);
+  if (begin < end) {
+    madvise((void *)begin, end - begin, MADV_DONTNEED);
+  }
+#endif
+}
+
+void bmpClose(BmpFile *pFile) {
+  if (pFile->fp != NULL) {
+    fclose(pFile->fp);
+  }
+#ifdef BMP_USE_MMAP
+  if (pFile->pFileData != NULL) {
+    munmap(pFile->pFileData, pFile->fileSize);
+  }
+#endif
+  free(pFile->pStrip);
+  memset(pFile, 0, sizeof(BmpFile));
+}
+
+static void pixelsToRGBAScalar(const unsigned char *pSrc, unsigned char *pDst,
+                               int count, int forceOpaque) {
+  for (int i = 0; i < count; i++) {
+    unsigned char b = pSrc[4 * i];
+    unsigned char g = pSrc[4 * i + 1];
+    unsigned char r = pSrc[4 * i + 2];
+    unsigned char a = pSrc[4 * i + 3];
+    pDst[4 * i] = r;
+    pDst[4 * i + 1] = g;
+    pDst[4 * i + 2] = b;
+    pDst[4 * i + 3] = forceOpaque ? 255 : a;
+  }
+}
+
+// per pixel: keep G and A, swap the 16 bit halves holding B and R
+#ifdef BMP_FILE_X86
+__attribute__((target("sse2"))) static void
+pixelsToRGBASse2(const unsigned char *pSrc, unsigned char *pDst, int count,
+                 int forceOpaque) {
+  const __m128i maskGA = _mm_set1_epi32((int)0xff00ff00);
+  const __m128i alpha = _mm_set1_epi32(forceOpaque ? (int)0xff000000 : 0);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(pSrc + 4 * i));
+    __m128i rb = _mm_andnot_si128(maskGA, x);
+    rb = _mm_shufflehi_epi16(_mm_shufflelo_epi16(rb, 0xb1), 0xb1);
+    x = _mm_or_si128(_mm_and_si128(x, maskGA), rb);
+    _mm_storeu_si128((__m128i *)(pDst + 4 * i), _mm_or_si128(x, alpha));
+  }
+  pixelsToRGBAScalar(pSrc + 4 * i, pDst + 4 * i, count - i, forceOpaque);
+}
+
+__attribute__((target("avx2"))) static void
+pixelsToRGBAAvx2(const unsigned char *pSrc, unsigned char *pDst, int count,
+                 int forceOpaque) {
+  const __m256i maskGA = _mm256_set1_epi32((int)0xff00ff00);
+  const __m256i alpha = _mm256_set1_epi32(forceOpaque ? (int)0xff000000 : 0);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(pSrc + 4 * i));
+    __m256i rb = _mm256_andnot_si256(maskGA, x);
+    rb = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(rb, 0xb1), 0xb1);
+    x = _mm256_or_si256(_mm256_and_si256(x, maskGA), rb);
+    _mm256_storeu_si256((__m256i *)(pDst + 4 * i), _mm256_or_si256(x, alpha));
+  }
+  pixelsToRGBASse2(pSrc + 4 * i, pDst + 4 * i, count - i, forceOpaque);
+}
+#endif
+
+typedef void (*PixelsToRGBAKernel)(const unsigned char *, unsigned char *,
+                                   int, int);
+
+// picked once from what the CPU supports
+static PixelsToRGBAKernel selectPixelsToRGBA() {
+#ifdef BMP_FILE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return pixelsToRGBAAvx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return pixelsToRGBASse2;
+  }
+#endif
+  return pixelsToRGBAScalar;
+}
+
+void bmpPixelsToRGBA(const unsigned char *pSrc, unsigned char *pDst,
+                     int count, int forceOpaque) {
+  static const PixelsToRGBAKernel s_kernel = selectPixelsToRGBA();
+  s_kernel(pSrc, pDst, count, forceOpaque);
+}
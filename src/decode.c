@@ -1,6 +1,9 @@
 #include <memory.h>
+#include <stdint.h>
 #include <string.h>
 
+#include "decode.h"
+
 int decode(const unsigned char *pTile, int nTileSize, unsigned char *pClrBlk) {
   const unsigned char *pTileEnd = pTile + nTileSize - 2;
 
@@ -43,3 +46,154 @@ int decode(const unsigned char *pTile, int nTileSize, unsigned char *pClrBlk) {
 
   return 0;
 }
+
+/// Fill `nByte` bytes at `pDest` with the `nOffset`-byte pattern just before
+/// it. Works in 8-byte stores, so it may write up to 7 bytes past the end.
+static void expandPattern(unsigned char *pDest, unsigned int nOffset,
+                          unsigned int nByte) {
+  uint64_t pattern;
+  if (nOffset == 1) {
+    pattern = pDest[-1] * 0x0101010101010101ull;
+  } else if (nOffset == 2) {
+    uint16_t half;
+    memcpy(&half, pDest - 2, 2);
+    pattern = half * 0x0001000100010001ull;
+  } else {
+    uint32_t word;
+    memcpy(&word, pDest - 4, 4);
+    pattern = word * 0x0000000100000001ull;
+  }
+  for (unsigned int n = 0; n < nByte; n += 8) {
+    memcpy(pDest + n, &pattern, 8);
+  }
+}
+
+/// Copy an `nByte` match from `nOffset` bytes back to `pDest`, in chunks.
+/// May write up to 15 bytes past the end.
+static void copyMatch(unsigned char *pDest, unsigned int nOffset,
+                      unsigned int nByte) {
+  const unsigned char *pSrc = pDest - nOffset;
+  if (nOffset >= 16) {
+    for (unsigned int n = 0; n < nByte; n += 16) {
+      memcpy(pDest + n, pSrc + n, 16);
+    }
+  } else if (nOffset >= 8) {
+    for (unsigned int n = 0; n < nByte; n += 8) {
+      memcpy(pDest + n, pSrc + n, 8);
+    }
+  } else if (nOffset == 1 || nOffset == 2 || nOffset == 4) {
+    expandPattern(pDest, nOffset, nByte);
+  } else {
+    while (nByte--) {
+      *pDest++ = *pSrc++;
+    }
+  }
+}
+
+int decodeFast(const unsigned char *pTile, int nTileSize,
+               unsigned char *pClrBlk) {
+  const unsigned char *pTileLast = pTile + nTileSize;
+  const unsigned char *pTileEnd = pTileLast - 2;
+
+  unsigned int headByte = (*pTile++) & 31;
+
+  while (1) {
+    if (headByte < 32) {
+      headByte++;
+      // A literal run is at most 32 bytes: copy all of them at once when the
+      // input allows and let the next token overwrite the excess.
+      if (pTile + 32 <= pTileLast) {
+        memcpy(pClrBlk, pTile, 32);
+      } else {
+        memcpy(pClrBlk, pTile, headByte);
+      }
+      pClrBlk += headByte;
+      pTile += headByte;
+    } else {
+      unsigned int nByte = (headByte >> 5) - 1;
+      if (nByte == 6) {
+        nByte += *pTile;
+        pTile++;
+      }
+      nByte += 3;
+      unsigned int nOffset = ((headByte & 31) << 8) + *pTile + 1;
+      pTile++;
+
+      copyMatch(pClrBlk, nOffset, nByte);
+      pClrBlk += nByte;
+    }
+
+    if (pTile > pTileEnd)
+      break;
+
+    headByte = *pTile++;
+  }
+
+  return 0;
+}
+
+int decodeSafe(const unsigned char *pTile, int nTileSize,
+               unsigned char *pClrBlk, int nClrBlkCapacity) {
+  if (nTileSize < 1 || nClrBlkCapacity < 0) {
+    return -1;
+  }
+  const unsigned char *pTileLast = pTile + nTileSize;
+  const unsigned char *pTileEnd = pTileLast - 2;
+  unsigned char *pClrBlkStart = pClrBlk;
+  unsigned char *pClrBlkLast = pClrBlk + nClrBlkCapacity;
+
+  unsigned int headByte = (*pTile++) & 31;
+
+  while (1) {
+    if (headByte < 32) {
+      headByte++;
+      // Both bounds are checked once for the whole 32-byte over-copy; only
+      // tokens near either end need the exact checks.
+      if (pTile + 32 <= pTileLast && pClrBlk + 32 <= pClrBlkLast) {
+        memcpy(pClrBlk, pTile, 32);
+      } else if (headByte <= (unsigned int)(pTileLast - pTile) &&
+                 headByte <= (unsigned int)(pClrBlkLast - pClrBlk)) {
+        memcpy(pClrBlk, pTile, headByte);
+      } else {
+        return -1;
+      }
+      pClrBlk += headByte;
+      pTile += headByte;
+    } else {
+      unsigned int nByte = (headByte >> 5) - 1;
+      if (pTileLast - pTile < (nByte == 6 ? 2 : 1)) {
+        return -1;
+      }
+      if (nByte == 6) {
+        nByte += *pTile;
+        pTile++;
+      }
+      nByte += 3;
+      unsigned int nOffset = ((headByte & 31) << 8) + *pTile + 1;
+      pTile++;
+
+      if (nOffset > (unsigned int)(pClrBlk - pClrBlkStart)) {
+        return -1;
+      }
+      unsigned int nRoom = pClrBlkLast - pClrBlk;
+      if (nByte + DECODE_SLACK <= nRoom) {
+        copyMatch(pClrBlk, nOffset, nByte);
+      } else if (nByte <= nRoom) {
+        const unsigned char *pSrc = pClrBlk - nOffset;
+        for (unsigned int n = 0; n < nByte; ++n) {
+          pClrBlk[n] = pSrc[n];
+        }
+      } else {
+        return -1;
+      }
+      pClrBlk += nByte;
+    }
+
+    if (pTile > pTileEnd)
+      break;
+
+    headByte = *pTile++;
+  }
+
+  return pClrBlk - pClrBlkStart;
+}
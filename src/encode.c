@@ -1,16 +1,12 @@
 #include "encode.h"
+#include "lzCommon.h"
 #include <memory.h>
 #include <stdint.h>
 #include <stdlib.h>
 
-#define MAX_LEN 264
-
 extern int g_nTileWidth;
 extern int g_nTileHeight;
 
-uint32_t readWord(const uint8_t *p);
-uint32_t compare(const uint8_t *p1, const uint8_t *p2, const uint8_t *bound);
-
 typedef struct InputInfo_ {
   const uint8_t *start;
   uint32_t size;
@@ -23,6 +19,8 @@ typedef struct InputInfo_ {
 } InputInfo;
 
 InputInfo *InputInfo_init(const uint8_t *start, const uint32_t size);
+void InputInfo_setup(InputInfo *self, const uint8_t *start,
+                     const uint32_t size);
 void InputInfo_free(InputInfo *self);
 const uint8_t *InputInfo_getStart(const InputInfo *self);
 const uint8_t *InputInfo_getEnd(const InputInfo *self);
@@ -32,7 +30,13 @@ int InputInfo_exceedsLimit(const InputInfo *self, const uint8_t *p);
 typedef struct HashTable_ {
   uint8_t key_size_;
   uint32_t size_;
-  uint32_t *table;
+  // Entries are stored as `base_ + position`. Anything below `base_` belongs
+  // to a previous input and reads back as position 0, like a fresh table.
+  uint32_t base_;
+  // Largest value an entry can hold: UINT32_MAX, or UINT16_MAX for the
+  // compact table.
+  uint32_t entry_max_;
+  void *table;
 
   uint32_t (*get)(const struct HashTable_ *self, uint32_t key);
   void (*set)(struct HashTable_ *self, uint32_t key, uint32_t value);
@@ -41,10 +45,17 @@ typedef struct HashTable_ {
 
 HashTable *HashTable_init(int key_size,
                           uint16_t (*hashFunc)(const HashTable *, uint32_t));
+HashTable *
+HashTable_initCompact(int key_size,
+                      uint16_t (*hashFunc)(const HashTable *, uint32_t));
 void HashTable_free(HashTable *self);
 uint32_t HashTable_get(const HashTable *self, uint32_t key);
 void HashTable_set(HashTable *self, uint32_t key, uint32_t value);
+uint32_t HashTable_getCompact(const HashTable *self, uint32_t key);
+void HashTable_setCompact(HashTable *self, uint32_t key, uint32_t value);
+void HashTable_invalidate(HashTable *self, uint32_t span);
 uint16_t HashTable_normalHashFunc(const HashTable *self, uint32_t key);
+uint16_t HashTable_multiplyHashFunc(const HashTable *self, uint32_t key);
 
 typedef struct OutputInfo_ {
   uint8_t *start;
@@ -59,32 +70,30 @@ typedef struct OutputInfo_ {
 } OutputInfo;
 
 OutputInfo *OutputInfo_init(uint8_t *start);
+void OutputInfo_setup(OutputInfo *self, uint8_t *start);
 void OutputInfo_free(OutputInfo *self);
 int32_t OutputInfo_getSize(const OutputInfo *self);
 void OutputInfo_dumpLiterals(OutputInfo *self, uint32_t runs,
                              const uint8_t *src);
 void OutputInfo_dumpMatch(OutputInfo *self, uint32_t length, uint32_t distance);
 
-/// COMMON FUNCTIONS
-uint32_t readWord(const uint8_t *p) { return *(uint32_t *)p; }
-
-uint32_t compare(const uint8_t *p1, const uint8_t *p2, const uint8_t *bound) {
-  const uint8_t *start = p1;
-  if (readWord(p1) == readWord(p2)) {
-    p1 += 4;
-    p2 += 4;
-  }
-  while (p2 < bound) {
-    if (*p1++ != *p2++) {
-      break;
-    }
-  }
-  return p1 - start;
-}
+struct EncodeContext_ {
+  InputInfo input_info;
+  OutputInfo output_info;
+  HashTable *hash_table;
+  // Largest input the hash table can index, 0 for no limit.
+  uint32_t max_input_size;
+};
 
 /// INPUT INFO
 InputInfo *InputInfo_init(const uint8_t *start, const uint32_t size) {
   InputInfo *self = (InputInfo *)malloc(sizeof(InputInfo));
+  InputInfo_setup(self, start, size);
+  return self;
+}
+
+void InputInfo_setup(InputInfo *self, const uint8_t *start,
+                     const uint32_t size) {
   self->start = start;
   self->size = size;
 
@@ -92,8 +101,6 @@ InputInfo *InputInfo_init(const uint8_t *start, const uint32_t size) {
   self->getEnd = InputInfo_getEnd;
   self->getLimit = InputInfo_getLimit;
   self->exceedsLimit = InputInfo_exceedsLimit;
-
-  return self;
 }
 
 void InputInfo_free(InputInfo *self) { free(self); }
@@ -113,17 +120,38 @@ int InputInfo_exceedsLimit(const InputInfo *self, const uint8_t *p) {
 }
 
 /// HASH TABLE
-HashTable *HashTable_init(int key_size,
-                          uint16_t (*hashFunc)(const HashTable *, uint32_t)) {
+static HashTable *
+HashTable_create(int key_size, uint32_t entry_max, size_t entry_bytes,
+                 uint16_t (*hashFunc)(const HashTable *, uint32_t)) {
   HashTable *self = (HashTable *)malloc(sizeof(HashTable));
   self->key_size_ = key_size;
   self->size_ = 1 << key_size;
-  self->table = (uint32_t *)malloc(sizeof(uint32_t) * self->size_);
+  self->base_ = 0;
+  self->entry_max_ = entry_max;
+  self->table = calloc(self->size_, entry_bytes);
 
+  self->hashFunc = hashFunc;
+  return self;
+}
+
+HashTable *HashTable_init(int key_size,
+                          uint16_t (*hashFunc)(const HashTable *, uint32_t)) {
+  HashTable *self =
+      HashTable_create(key_size, UINT32_MAX, sizeof(uint32_t), hashFunc);
   self->get = HashTable_get;
   self->set = HashTable_set;
-  self->hashFunc = hashFunc;
-  memset(self->table, 0, sizeof(uint32_t) * self->size_);
+  return self;
+}
+
+/// A table of 16-bit positions, for inputs of up to 16 KB. At 8-10 key bits
+/// it takes 0.5-2 KB, small enough to stay in L1 next to the tile.
+HashTable *
+HashTable_initCompact(int key_size,
+                      uint16_t (*hashFunc)(const HashTable *, uint32_t)) {
+  HashTable *self =
+      HashTable_create(key_size, UINT16_MAX, sizeof(uint16_t), hashFunc);
+  self->get = HashTable_getCompact;
+  self->set = HashTable_setCompact;
   return self;
 }
 
@@ -133,11 +161,35 @@ void HashTable_free(HashTable *self) {
 }
 
 uint32_t HashTable_get(const HashTable *self, uint32_t key) {
-  return self->table[key & (self->size_ - 1)];
+  uint32_t entry = ((const uint32_t *)self->table)[key & (self->size_ - 1)];
+  return entry >= self->base_ ? entry - self->base_ : 0;
 }
 
 void HashTable_set(HashTable *self, uint32_t key, uint32_t value) {
-  self->table[key & (self->size_ - 1)] = value;
+  ((uint32_t *)self->table)[key & (self->size_ - 1)] = self->base_ + value;
+}
+
+uint32_t HashTable_getCompact(const HashTable *self, uint32_t key) {
+  uint32_t entry = ((const uint16_t *)self->table)[key & (self->size_ - 1)];
+  return entry >= self->base_ ? entry - self->base_ : 0;
+}
+
+void HashTable_setCompact(HashTable *self, uint32_t key, uint32_t value) {
+  ((uint16_t *)self->table)[key & (self->size_ - 1)] = self->base_ + value;
+}
+
+/// Forget every entry in O(1) by moving `base_` past all stored positions.
+/// `span` must be greater than any position set since the last call. The
+/// table is only cleared for real when `base_` is about to overflow an entry.
+void HashTable_invalidate(HashTable *self, uint32_t span) {
+  if (self->base_ > self->entry_max_ - 2 * span) {
+    size_t entry_bytes =
+        self->entry_max_ == UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t);
+    memset(self->table, 0, entry_bytes * self->size_);
+    self->base_ = 0;
+  } else {
+    self->base_ += span;
+  }
 }
 
 uint16_t HashTable_normalHashFunc(const HashTable *self, uint32_t key) {
@@ -145,9 +197,20 @@ uint16_t HashTable_normalHashFunc(const HashTable *self, uint32_t key) {
   return ((key ^ 0x9E3779B9) >> (32 - self->key_size_)) & mask;
 }
 
+/// Fibonacci hashing: unlike `HashTable_normalHashFunc`, every key bit
+/// reaches the top `key_size_` bits, which matters for small tables.
+uint16_t HashTable_multiplyHashFunc(const HashTable *self, uint32_t key) {
+  return (key * 2654435761u) >> (32 - self->key_size_);
+}
+
 /// OUTPUT INFO
 OutputInfo *OutputInfo_init(uint8_t *start) {
   OutputInfo *self = (OutputInfo *)malloc(sizeof(OutputInfo));
+  OutputInfo_setup(self, start);
+  return self;
+}
+
+void OutputInfo_setup(OutputInfo *self, uint8_t *start) {
   self->start = start;
   self->end = start;
   self->current = start;
@@ -155,7 +218,6 @@ OutputInfo *OutputInfo_init(uint8_t *start) {
   self->getSize = OutputInfo_getSize;
   self->dumpLiterals = OutputInfo_dumpLiterals;
   self->dumpMatch = OutputInfo_dumpMatch;
-  return self;
 }
 
 void OutputInfo_free(OutputInfo *self) { free(self); }
@@ -166,49 +228,18 @@ int32_t OutputInfo_getSize(const OutputInfo *self) {
 
 void OutputInfo_dumpLiterals(OutputInfo *self, uint32_t runs,
                              const uint8_t *src) {
-  while (runs >= 32) {
-    *self->current++ = 31;
-    memcpy(self->current, src, 32);
-    self->current += 32;
-    runs -= 32;
-    src += 32;
-  }
-  if (runs > 0) {
-    *self->current++ = runs - 1;
-    memcpy(self->current, src, runs);
-    self->current += runs;
-  }
+  self->current = lzDumpLiterals(self->current, runs, src);
 }
 
 void OutputInfo_dumpMatch(OutputInfo *self, uint32_t length,
                           uint32_t distance) {
-  --distance;
-  if (length > MAX_LEN - 2) {
-    while (length > MAX_LEN - 2) {
-      *self->current++ = (7 << 5) + (distance >> 8);
-      *self->current++ = MAX_LEN - 2 - 7 - 2;
-      *self->current++ = (distance & 255);
-      length -= MAX_LEN - 2;
-    }
-  }
-  if (length < 7) {
-    *self->current++ = (length << 5) + (distance >> 8);
-    *self->current++ = (distance & 255);
-  } else {
-    *self->current++ = (7 << 5) + (distance >> 8);
-    *self->current++ = length - 7;
-    *self->current++ = (distance & 255);
-  }
+  self->current = lzDumpMatch(self->current, length, distance);
 }
 
-int encode(unsigned char *pTile, int *pTileSize, const unsigned char *pClrBlk) {
-  const int input_length = g_nTileHeight * g_nTileWidth * 4;
-
-  InputInfo *input_info = InputInfo_init(pClrBlk, input_length);
-
-  OutputInfo *output_info = OutputInfo_init(pTile);
-  HashTable *hash_table = HashTable_init(12, HashTable_normalHashFunc);
-
+/// Greedy LZ77 parse of `input_info` into `output_info`. `hash_table` must
+/// not hold any position of a previous input.
+static void encodeBlock(const InputInfo *input_info, OutputInfo *output_info,
+                        HashTable *hash_table) {
   const uint8_t *anchor = input_info->getStart(input_info);
   const uint8_t *ip = input_info->getStart(input_info);
 
@@ -221,7 +252,7 @@ int encode(unsigned char *pTile, int *pTileSize, const unsigned char *pClrBlk) {
 
     uint32_t seq;
     do {
-      seq = readWord(ip) & 0xffffff;
+      seq = lzReadWord(ip) & 0xffffff;
       uint16_t hash = hash_table->hashFunc(hash_table, seq);
       ref =
           input_info->getStart(input_info) + hash_table->get(hash_table, hash);
@@ -232,7 +263,7 @@ int encode(unsigned char *pTile, int *pTileSize, const unsigned char *pClrBlk) {
         break;
       }
       ++ip;
-    } while (seq != (readWord(ref) & 0xffffff));
+    } while (seq != (lzReadWord(ref) & 0xffffff));
 
     if (ip >= limit) {
       break;
@@ -244,11 +275,11 @@ int encode(unsigned char *pTile, int *pTileSize, const unsigned char *pClrBlk) {
     }
 
     uint32_t length =
-        compare(ref + 3, ip + 3, input_info->getEnd(input_info) - 4);
+        lzCompare(ref + 3, ip + 3, input_info->getEnd(input_info) - 4);
     output_info->dumpMatch(output_info, length, distance);
 
     ip += length;
-    seq = readWord(ip);
+    seq = lzReadWord(ip);
     uint16_t hash = hash_table->hashFunc(hash_table, seq & 0xffffff);
     hash_table->set(hash_table, hash, ip++ - input_info->getStart(input_info));
     seq >>= 8;
@@ -260,12 +291,60 @@ int encode(unsigned char *pTile, int *pTileSize, const unsigned char *pClrBlk) {
 
   uint32_t left = input_info->getEnd(input_info) - anchor;
   output_info->dumpLiterals(output_info, left, anchor);
-  *pTileSize = output_info->getSize(output_info);
+}
+
+/// ENCODE CONTEXT
+EncodeContext *EncodeContext_init(void) {
+  EncodeContext *self = (EncodeContext *)malloc(sizeof(EncodeContext));
+  self->hash_table = HashTable_init(12, HashTable_normalHashFunc);
+  self->max_input_size = 0;
+  return self;
+}
 
-  // Clean up.
-  HashTable_free(hash_table);
-  OutputInfo_free(output_info);
-  InputInfo_free(input_info);
+EncodeContext *EncodeContext_initCompact(int max_input_size) {
+  if (max_input_size <= 0 || max_input_size > 16384) {
+    return NULL;
+  }
+  // About two slots per input position, within 8 to 10 key bits.
+  int key_size = 8;
+  while (key_size < 10 && (1 << key_size) < 2 * max_input_size) {
+    ++key_size;
+  }
+  EncodeContext *self = (EncodeContext *)malloc(sizeof(EncodeContext));
+  self->hash_table =
+      HashTable_initCompact(key_size, HashTable_multiplyHashFunc);
+  self->max_input_size = max_input_size;
+  return self;
+}
+
+void EncodeContext_free(EncodeContext *self) {
+  HashTable_free(self->hash_table);
+  free(self);
+}
 
+int EncodeContext_encode(EncodeContext *self, unsigned char *pTile,
+                         int *pTileSize, const unsigned char *pClrBlk,
+                         int nClrBlkSize) {
+  if (self->max_input_size > 0 &&
+      (uint32_t)nClrBlkSize > self->max_input_size) {
+    return -1;
+  }
+  InputInfo_setup(&self->input_info, pClrBlk, nClrBlkSize);
+  OutputInfo_setup(&self->output_info, pTile);
+
+  encodeBlock(&self->input_info, &self->output_info, self->hash_table);
+  *pTileSize = self->output_info.getSize(&self->output_info);
+
+  HashTable_invalidate(self->hash_table, nClrBlkSize);
   return 0; // return normally
 }
+
+int encode(unsigned char *pTile, int *pTileSize, const unsigned char *pClrBlk) {
+  const int input_length = g_nTileHeight * g_nTileWidth * 4;
+
+  EncodeContext *context = EncodeContext_init();
+  int result =
+      EncodeContext_encode(context, pTile, pTileSize, pClrBlk, input_length);
+  EncodeContext_free(context);
+  return result;
+}
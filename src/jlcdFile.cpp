@@ -0,0 +1,340 @@
+/* jlcdFile.cpp
+ *  read-only access to JLCD files
+ */
+#include "jlcdFile.h"
+#include "defines.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define JLCD_USE_MMAP 1
+#endif
+
+static int readInt(const unsigned char *p) {
+  int value;
+  memcpy(&value, p, 4);
+  return value;
+}
+
+/* pOffsets[i + 1] = pOffsets[i] + size of tile i, for the uint16 sizes
+ * of a version 2 index. Eight sizes at a time: each half is summed in
+ * register by two shifted adds, then the running total is added on.
+ *  return:
+ *     0 -- succeed
+ *    -1 -- a tile size is 0 without `allowEmpty`, or the total does not
+ *          fit 32 bits
+ */
+static int sumTileSizes(const unsigned char *pSizes, int count,
+                        int allowEmpty, unsigned int *pOffsets) {
+  uint32_t total = 0;
+  int i = 0;
+  pOffsets[0] = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i running = zero;
+  __m128i empty = zero;
+  for (; i + 8 <= count; i += 8) {
+    __m128i sizes = _mm_loadu_si128((const __m128i *)(pSizes + 2 * i));
+    empty = _mm_or_si128(empty, _mm_cmpeq_epi16(sizes, zero));
+    __m128i low = _mm_unpacklo_epi16(sizes, zero);
+    __m128i high = _mm_unpackhi_epi16(sizes, zero);
+    low = _mm_add_epi32(low, _mm_slli_si128(low, 4));
+    low = _mm_add_epi32(low, _mm_slli_si128(low, 8));
+    high = _mm_add_epi32(high, _mm_slli_si128(high, 4));
+    high = _mm_add_epi32(high, _mm_slli_si128(high, 8));
+    low = _mm_add_epi32(low, running);
+    running = _mm_shuffle_epi32(low, 0xff);
+    high = _mm_add_epi32(high, running);
+    running = _mm_shuffle_epi32(high, 0xff);
+    _mm_storeu_si128((__m128i *)(pOffsets + i + 1), low);
+    _mm_storeu_si128((__m128i *)(pOffsets + i + 5), high);
+    // eight sizes add less than 2^32, so a wrap makes the total smaller
+    uint32_t blockTotal = _mm_cvtsi128_si32(running);
+    if (blockTotal < total) {
+      return -1;
+    }
+    total = blockTotal;
+  }
+  if (!allowEmpty && _mm_movemask_epi8(empty) != 0) {
+    return -1;
+  }
+#endif
+  for (; i < count; i++) {
+    uint16_t size;
+    memcpy(&size, pSizes + 2 * i, 2);
+    if ((size == 0 && !allowEmpty) || total + size < total) {
+      return -1;
+    }
+    total += size;
+    pOffsets[i + 1] = total;
+  }
+  return 0;
+}
+
+/* find the frames of a sequence and select the first one */
+static int parseFrames(JlcdFile *pFile) {
+  size_t size = pFile->fileSize;
+  if (size < JLCD_SEQ_HEADER_SIZE) {
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  pFile->frameCount = readInt(pFile->pFileData + JLCD_HEADER_SIZE);
+  if (pFile->frameCount <= 0 ||
+      (size_t)pFile->frameCount >
+          (size - JLCD_SEQ_HEADER_SIZE) / JLCD_FRAME_HEADER_SIZE) {
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  pFile->pFrameOffsets = static_cast<size_t *>(
+      malloc(((size_t)pFile->frameCount + 1) * sizeof(size_t)));
+  pFile->pTileOffsets = static_cast<unsigned int *>(
+      malloc(((size_t)pFile->tileCount + 1) * sizeof(unsigned int)));
+  if (pFile->pFrameOffsets == NULL || pFile->pTileOffsets == NULL) {
+    return ERROR_INVALID_INPUT_FILE;
+  }
+
+  // every frame must hold at least its index
+  size_t tileInfoSize = (size_t)pFile->tileCount * JLCD_V2_TILE_INFO_SIZE;
+  size_t position = JLCD_SEQ_HEADER_SIZE;
+  for (int i = 0; i < pFile->frameCount; i++) {
+    if (size - position < JLCD_FRAME_HEADER_SIZE) {
+      return ERROR_INVALID_INPUT_FILE;
+    }
+    uint32_t frameSize;
+    memcpy(&frameSize, pFile->pFileData + position, 4);
+    position += JLCD_FRAME_HEADER_SIZE;
+    if (frameSize < tileInfoSize || frameSize > size - position) {
+      return ERROR_INVALID_INPUT_FILE;
+    }
+    pFile->pFrameOffsets[i] = position - JLCD_FRAME_HEADER_SIZE;
+    position += frameSize;
+  }
+  pFile->pFrameOffsets[pFile->frameCount] = position;
+  return jlcdSelectFrame(pFile, 0);
+}
+
+int jlcdSelectFrame(JlcdFile *pFile, int frame) {
+  if (frame < 0 || frame >= pFile->frameCount) {
+    return ERROR_INVALID_PARAM;
+  }
+  if (pFile->version != 3) {
+    return ERROR_OK;
+  }
+  size_t begin = pFile->pFrameOffsets[frame] + JLCD_FRAME_HEADER_SIZE;
+  size_t tileInfoSize = (size_t)pFile->tileCount * JLCD_V2_TILE_INFO_SIZE;
+  pFile->frame = frame;
+  pFile->pTileInfos = pFile->pFileData + begin;
+  pFile->pTileData = pFile->pTileInfos + tileInfoSize;
+  pFile->tileDataSize = pFile->pFrameOffsets[frame + 1] - begin - tileInfoSize;
+  // the first frame has nothing to keep tiles from
+  if (sumTileSizes(pFile->pTileInfos, pFile->tileCount, frame > 0,
+                   pFile->pTileOffsets) != 0 ||
+      pFile->pTileOffsets[pFile->tileCount] > pFile->tileDataSize) {
+    pFile->pTileData = NULL;
+    pFile->tileDataSize = 0;
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  return ERROR_OK;
+}
+
+int jlcdParseHeader(JlcdFile *pFile, const unsigned char *pData,
+                    size_t size) {
+  memset(pFile, 0, sizeof(JlcdFile));
+  pFile->pFileData = pData;
+  pFile->fileSize = size;
+
+  if (size < JLCD_HEADER_SIZE) {
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  if (memcmp(pData, JLCD_MAGIC, 4) == 0) {
+    pFile->version = 1;
+  } else if (memcmp(pData, JLCD_V2_MAGIC, 4) == 0) {
+    pFile->version = 2;
+  } else if (memcmp(pData, JLCD_SEQ_MAGIC, 4) == 0) {
+    pFile->version = 3;
+  } else {
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  pFile->imgWidth = readInt(pData + 4);
+  pFile->imgHeight = readInt(pData + 8);
+  pFile->tileWidth = readInt(pData + 12);
+  pFile->tileHeight = readInt(pData + 16);
+  pFile->tileCount = readInt(pData + 20);
+  if (pFile->imgWidth <= 0 || pFile->imgHeight <= 0 ||
+      pFile->tileWidth <= 0 || pFile->tileHeight <= 0 ||
+      (long long)pFile->tileCount !=
+          (long long)(pFile->imgWidth / pFile->tileWidth) *
+              (pFile->imgHeight / pFile->tileHeight)) {
+    return ERROR_INVALID_INPUT_FILE;
+  }
+
+  pFile->frameCount = 1;
+  if (pFile->version == 3) {
+    return ERROR_OK;
+  }
+
+  size_t tileInfoSize =
+      (size_t)pFile->tileCount *
+      (pFile->version == 1 ? JLCD_TILE_INFO_SIZE : JLCD_V2_TILE_INFO_SIZE);
+  if (size - JLCD_HEADER_SIZE < tileInfoSize) {
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  pFile->pTileInfos = pData + JLCD_HEADER_SIZE;
+  pFile->pTileData = pFile->pTileInfos + tileInfoSize;
+  pFile->tileDataSize = size - JLCD_HEADER_SIZE - tileInfoSize;
+  return ERROR_OK;
+}
+
+int jlcdParse(JlcdFile *pFile, const unsigned char *pData, size_t size) {
+  int ret = jlcdParseHeader(pFile, pData, size);
+  if (ret != ERROR_OK) {
+    return ret;
+  }
+  if (pFile->version == 3) {
+    return parseFrames(pFile);
+  }
+
+  if (pFile->version == 2) {
+    // the whole index in one sequential pass; the tiles are back to back,
+    // so checking the total checks every span
+    pFile->pTileOffsets = static_cast<unsigned int *>(
+        malloc(((size_t)pFile->tileCount + 1) * sizeof(unsigned int)));
+    if (pFile->pTileOffsets == NULL ||
+        sumTileSizes(pFile->pTileInfos, pFile->tileCount, 0,
+                     pFile->pTileOffsets) != 0 ||
+        pFile->pTileOffsets[pFile->tileCount] > pFile->tileDataSize) {
+      return ERROR_INVALID_INPUT_FILE;
+    }
+    return ERROR_OK;
+  }
+
+  // check every tile span once, so that jlcdGetTile() needs no checks
+  for (int i = 0; i < pFile->tileCount; i++) {
+    if (jlcdCheckTile(pFile, i) != ERROR_OK) {
+      return ERROR_INVALID_INPUT_FILE;
+    }
+  }
+  return ERROR_OK;
+}
+
+int jlcdCheckTile(const JlcdFile *pFile, int tileIndex) {
+  if (pFile->version != 1) {
+    // spans of back to back tiles are checked with their offsets
+    return pFile->pTileOffsets != NULL ? ERROR_OK : ERROR_INVALID_INPUT_FILE;
+  }
+  const unsigned char *pInfo =
+      pFile->pTileInfos + (size_t)tileIndex * JLCD_TILE_INFO_SIZE;
+  int tilePosition = readInt(pInfo);
+  int tileSize = readInt(pInfo + 4);
+  if (tilePosition < 0 || tileSize <= 0 ||
+      (size_t)tilePosition > pFile->tileDataSize ||
+      (size_t)tileSize > pFile->tileDataSize - tilePosition) {
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  return ERROR_OK;
+}
+
+/* map or read the whole of `fileName`; `willNeed` asks for all of it to be
+ * read ahead
+ */
+static int loadFile(char const *fileName, int willNeed,
+                    unsigned char **ppData, size_t *pSize) {
+  unsigned char *pData = NULL;
+  size_t size = 0;
+#ifdef JLCD_USE_MMAP
+  int fd = open(fileName, O_RDONLY);
+  if (fd < 0) {
+    return ERROR_INPUT_FILE;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return ERROR_INPUT_FILE;
+  }
+  size = st.st_size;
+  if (size > 0) {
+    void *pMapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (pMapped == MAP_FAILED) {
+      close(fd);
+      return ERROR_INPUT_FILE;
+    }
+    pData = static_cast<unsigned char *>(pMapped);
+    if (willNeed) {
+      madvise(pMapped, size, MADV_WILLNEED);
+    }
+  }
+  close(fd);
+#else
+  (void)willNeed;
+  FILE *fp = fopen(fileName, "rb");
+  if (fp == NULL) {
+    return ERROR_INPUT_FILE;
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  pData = static_cast<unsigned char *>(malloc(size > 0 ? size : 1));
+  if (pData == NULL || fread(pData, 1, size, fp) != size) {
+    free(pData);
+    fclose(fp);
+    return ERROR_INPUT_FILE;
+  }
+  fclose(fp);
+#endif
+  *ppData = pData;
+  *pSize = size;
+  return ERROR_OK;
+}
+
+int jlcdOpen(JlcdFile *pFile, char const *fileName) {
+  memset(pFile, 0, sizeof(JlcdFile));
+  unsigned char *pData = NULL;
+  size_t size = 0;
+  if (loadFile(fileName, 1, &pData, &size) != ERROR_OK) {
+    return ERROR_INPUT_FILE;
+  }
+  int ret = jlcdParse(pFile, pData, size);
+  pFile->ownsFileData = 1;
+  if (ret != ERROR_OK) {
+    jlcdClose(pFile);
+  }
+  return ret;
+}
+
+int jlcdOpenHeader(JlcdFile *pFile, char const *fileName) {
+  memset(pFile, 0, sizeof(JlcdFile));
+  unsigned char *pData = NULL;
+  size_t size = 0;
+  if (loadFile(fileName, 0, &pData, &size) != ERROR_OK) {
+    return ERROR_INPUT_FILE;
+  }
+  int ret = jlcdParseHeader(pFile, pData, size);
+  if (ret == ERROR_OK && pFile->version != 1) {
+    ret = jlcdParse(pFile, pData, size);
+  }
+  pFile->ownsFileData = 1;
+  if (ret != ERROR_OK) {
+    jlcdClose(pFile);
+  }
+  return ret;
+}
+
+void jlcdClose(JlcdFile *pFile) {
+  free(pFile->pTileOffsets);
+  free(pFile->pFrameOffsets);
+  if (pFile->ownsFileData && pFile->pFileData != NULL) {
+#ifdef JLCD_USE_MMAP
+    munmap(const_cast<unsigned char *>(pFile->pFileData), pFile->fileSize);
+#else
+    free(const_cast<unsigned char *>(pFile->pFileData));
+#endif
+  }
+  memset(pFile, 0, sizeof(JlcdFile));
+}
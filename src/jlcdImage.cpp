@@ -0,0 +1,397 @@
+/* jlcdImage.cpp
+ *  JLCD images held in memory: encode, re-encode changed tiles and decode
+ *  a rectangle
+ */
+#include "jlcdImage.h"
+#include "defines.h"
+#include "jlcdFile.h"
+#include "rgbTileProc.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define JLCD_IMAGE_TILE_SIZE 8
+
+static int readInt(const unsigned char *p) {
+  int value;
+  memcpy(&value, p, 4);
+  return value;
+}
+
+static void writeInt(unsigned char *p, int value) { memcpy(p, &value, 4); }
+
+/* gather tile (`column`, `row`) of `pRGBA` and encode it into `pTile`
+ *  return: the size of the tile data
+ */
+static int encodeTile(TileCodec *pCodec, const unsigned char *pRGBA,
+                      ptrdiff_t pitch, int column, int row,
+                      unsigned char *pTile) {
+  unsigned char pARGB[TILE_MAX_BYTES];
+  const int rowBytes = pCodec->nTileWidth * 4;
+  const unsigned char *pSrc = pRGBA +
+                              (ptrdiff_t)row * pCodec->nTileHeight * pitch +
+                              column * rowBytes;
+  for (int i = 0; i < pCodec->nTileHeight; i++) {
+    memcpy(pARGB + i * rowBytes, pSrc, rowBytes);
+    pSrc += pitch;
+  }
+  int size = 0;
+  argb2tileWithCodec(pCodec, pARGB, pTile, &size);
+  return size;
+}
+
+/* count the entries of the version 1 index `pInfos` whose position is in
+ * the sorted `positions`. For a few positions, blocks of four entries are
+ * matched against each with SSE2 and only the blocks hit are looked up.
+ */
+static void countReferences(const unsigned char *pInfos, int tileCount,
+                            const std::vector<int> &positions,
+                            std::vector<int> &references) {
+  references.assign(positions.size(), 0);
+  int i = 0;
+#if defined(__SSE2__)
+  const size_t MAX_MATCHED = 8;
+  for (; positions.size() <= MAX_MATCHED && i + 4 <= tileCount; i += 4) {
+    // {pos, len} pairs; only the even lanes are positions
+    const unsigned char *pBlock = pInfos + (size_t)i * JLCD_TILE_INFO_SIZE;
+    __m128i a = _mm_loadu_si128((const __m128i *)pBlock);
+    __m128i b = _mm_loadu_si128((const __m128i *)(pBlock + 16));
+    __m128i hitA = _mm_setzero_si128();
+    __m128i hitB = _mm_setzero_si128();
+    for (int position : positions) {
+      __m128i value = _mm_set1_epi32(position);
+      hitA = _mm_or_si128(hitA, _mm_cmpeq_epi32(a, value));
+      hitB = _mm_or_si128(hitB, _mm_cmpeq_epi32(b, value));
+    }
+    if (((_mm_movemask_ps(_mm_castsi128_ps(hitA)) |
+          _mm_movemask_ps(_mm_castsi128_ps(hitB))) &
+         0x5) == 0) {
+      continue;
+    }
+    for (int k = i; k < i + 4; k++) {
+      int position = readInt(pInfos + (size_t)k * JLCD_TILE_INFO_SIZE);
+      auto it = std::lower_bound(positions.begin(), positions.end(), position);
+      if (it != positions.end() && *it == position) {
+        references[it - positions.begin()]++;
+      }
+    }
+  }
+#endif
+  for (; i < tileCount; i++) {
+    int position = readInt(pInfos + (size_t)i * JLCD_TILE_INFO_SIZE);
+    auto it = std::lower_bound(positions.begin(), positions.end(), position);
+    if (it != positions.end() && *it == position) {
+      references[it - positions.begin()]++;
+    }
+  }
+}
+
+int jlcdEncode(std::vector<unsigned char> &image, const unsigned char *pRGBA,
+               ptrdiff_t pitch, int width, int height, int nLevel,
+               int nVersion) {
+  const int tileSize = JLCD_IMAGE_TILE_SIZE;
+  if (width <= 0 || height <= 0 || (nVersion != 1 && nVersion != 2) ||
+      (nVersion == 1 && nLevel != TILE_LEVEL_COMPAT)) {
+    return ERROR_INVALID_PARAM;
+  }
+  TileCodec *pCodec = tileCodecInitLevel(tileSize, tileSize, nLevel);
+  if (pCodec == NULL) {
+    return ERROR_INVALID_PARAM;
+  }
+  int numColumns = width / tileSize;
+  int numRows = height / tileSize;
+  int tileCount = numColumns * numRows;
+  int tileInfoSize =
+      nVersion == 2 ? JLCD_V2_TILE_INFO_SIZE : JLCD_TILE_INFO_SIZE;
+
+  image.assign(JLCD_HEADER_SIZE + (size_t)tileCount * tileInfoSize, 0);
+  memcpy(image.data(), nVersion == 2 ? JLCD_V2_MAGIC : JLCD_MAGIC, 4);
+  writeInt(image.data() + 4, width);
+  writeInt(image.data() + 8, height);
+  writeInt(image.data() + 12, tileSize);
+  writeInt(image.data() + 16, tileSize);
+  writeInt(image.data() + 20, tileCount);
+
+  size_t dataStart = image.size();
+  std::vector<unsigned char> tile(
+      tileEncodeBound(tileSize, tileSize, nLevel));
+  for (int tileIndex = 0; tileIndex < tileCount; tileIndex++) {
+    int size = encodeTile(pCodec, pRGBA, pitch, tileIndex % numColumns,
+                          tileIndex / numColumns, tile.data());
+    unsigned char *pInfo =
+        image.data() + JLCD_HEADER_SIZE + (size_t)tileIndex * tileInfoSize;
+    if (nVersion == 2) {
+      uint16_t size16 = size;
+      memcpy(pInfo, &size16, 2);
+    } else {
+      writeInt(pInfo, image.size() - dataStart);
+      writeInt(pInfo + 4, size);
+    }
+    image.insert(image.end(), tile.data(), tile.data() + size);
+  }
+  tileCodecFree(pCodec);
+  return ERROR_OK;
+}
+
+int jlcdUpdate(std::vector<unsigned char> &image, const unsigned char *pRGBA,
+               ptrdiff_t pitch, const JlcdRect *pRects, int rectCount,
+               int nLevel) {
+  // a version 1 image needs no more than the header; the entries of the
+  // tiles replaced are all that is read of the index
+  JlcdFile file;
+  int ret = jlcdParseHeader(&file, image.data(), image.size());
+  if (ret == ERROR_OK && file.version == 2) {
+    ret = jlcdParse(&file, image.data(), image.size());
+  }
+  if (ret != ERROR_OK || file.version == 3 ||
+      (file.version == 1 && nLevel != TILE_LEVEL_COMPAT)) {
+    jlcdClose(&file);
+    return ret != ERROR_OK ? ERROR_INVALID_INPUT_FILE : ERROR_INVALID_PARAM;
+  }
+  TileCodec *pCodec =
+      tileCodecInitLevel(file.tileWidth, file.tileHeight, nLevel);
+  if (pCodec == NULL) {
+    jlcdClose(&file);
+    return ERROR_INVALID_PARAM;
+  }
+  const int tileWidth = file.tileWidth;
+  const int tileHeight = file.tileHeight;
+  const int numColumns = file.imgWidth / tileWidth;
+  const int numRows = file.imgHeight / tileHeight;
+
+  // the tiles touched, each once and in index order
+  std::vector<int> dirtyTiles;
+  for (int i = 0; i < rectCount; i++) {
+    const JlcdRect &rect = pRects[i];
+    long long x0 = std::max(rect.x, 0);
+    long long y0 = std::max(rect.y, 0);
+    long long x1 = std::min((long long)rect.x + rect.width,
+                            (long long)numColumns * tileWidth);
+    long long y1 = std::min((long long)rect.y + rect.height,
+                            (long long)numRows * tileHeight);
+    if (rect.width <= 0 || rect.height <= 0 || x0 >= x1 || y0 >= y1) {
+      continue;
+    }
+    for (int row = y0 / tileHeight; row <= (y1 - 1) / tileHeight; row++) {
+      for (int column = x0 / tileWidth; column <= (x1 - 1) / tileWidth;
+           column++) {
+        dirtyTiles.push_back(row * numColumns + column);
+      }
+    }
+  }
+  std::sort(dirtyTiles.begin(), dirtyTiles.end());
+  dirtyTiles.erase(std::unique(dirtyTiles.begin(), dirtyTiles.end()),
+                   dirtyTiles.end());
+
+  std::vector<unsigned char> tile(
+      tileEncodeBound(tileWidth, tileHeight, nLevel));
+  if (file.version == 1) {
+    size_t dataStart =
+        JLCD_HEADER_SIZE + (size_t)file.tileCount * JLCD_TILE_INFO_SIZE;
+    // a deduplicated image may have other tiles on the span of a dirty
+    // one; such spans are kept and the new tile appended. The index is
+    // only searched once a tile would fit over its old one.
+    std::vector<int> dirtyPositions;
+    for (int tileIndex : dirtyTiles) {
+      dirtyPositions.push_back(
+          readInt(image.data() + JLCD_HEADER_SIZE +
+                  (size_t)tileIndex * JLCD_TILE_INFO_SIZE));
+    }
+    std::sort(dirtyPositions.begin(), dirtyPositions.end());
+    std::vector<int> references;
+    for (int tileIndex : dirtyTiles) {
+      int size = encodeTile(pCodec, pRGBA, pitch, tileIndex % numColumns,
+                            tileIndex / numColumns, tile.data());
+      size_t infoOffset =
+          JLCD_HEADER_SIZE + (size_t)tileIndex * JLCD_TILE_INFO_SIZE;
+      int position = readInt(image.data() + infoOffset);
+      int oldSize = readInt(image.data() + infoOffset + 4);
+      size_t dataSize = image.size() - dataStart;
+      bool inPlace = position >= 0 && oldSize >= size &&
+                     (size_t)position <= dataSize &&
+                     (size_t)oldSize <= dataSize - position;
+      if (inPlace && references.empty()) {
+        countReferences(image.data() + JLCD_HEADER_SIZE, file.tileCount,
+                        dirtyPositions, references);
+      }
+      if (inPlace) {
+        auto dirty = std::lower_bound(dirtyPositions.begin(),
+                                      dirtyPositions.end(), position);
+        inPlace = references[dirty - dirtyPositions.begin()] == 1;
+      }
+      if (inPlace) {
+        // over the old tile; the rest of its span goes unused
+        memcpy(image.data() + dataStart + position, tile.data(), size);
+      } else {
+        if (dataSize > (size_t)(INT_MAX - size)) {
+          ret = ERROR_INVALID_PARAM;
+          break;
+        }
+        position = dataSize;
+        image.insert(image.end(), tile.data(), tile.data() + size);
+      }
+      writeInt(image.data() + infoOffset, position);
+      writeInt(image.data() + infoOffset + 4, size);
+    }
+  } else {
+    // tiles are back to back, so everything after the first new tile moves
+    size_t dataStart =
+        JLCD_HEADER_SIZE + (size_t)file.tileCount * JLCD_V2_TILE_INFO_SIZE;
+    std::vector<unsigned char> updated(image.begin(),
+                                       image.begin() + dataStart);
+    updated.reserve(image.size());
+    size_t nextDirty = 0;
+    for (int tileIndex = 0; tileIndex < file.tileCount; tileIndex++) {
+      const unsigned char *pTile;
+      int size;
+      if (nextDirty < dirtyTiles.size() &&
+          dirtyTiles[nextDirty] == tileIndex) {
+        size = encodeTile(pCodec, pRGBA, pitch, tileIndex % numColumns,
+                          tileIndex / numColumns, tile.data());
+        pTile = tile.data();
+        nextDirty++;
+      } else {
+        jlcdGetTile(&file, tileIndex, &pTile, &size);
+      }
+      uint16_t size16 = size;
+      memcpy(updated.data() + JLCD_HEADER_SIZE +
+                 (size_t)tileIndex * JLCD_V2_TILE_INFO_SIZE,
+             &size16, 2);
+      updated.insert(updated.end(), pTile, pTile + size);
+    }
+    image.swap(updated);
+  }
+  tileCodecFree(pCodec);
+  jlcdClose(&file);
+  return ret;
+}
+
+int jlcdCompact(std::vector<unsigned char> &image) {
+  JlcdFile file;
+  if (jlcdParse(&file, image.data(), image.size()) != ERROR_OK ||
+      file.version != 1) {
+    jlcdClose(&file);
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  size_t dataStart =
+      JLCD_HEADER_SIZE + (size_t)file.tileCount * JLCD_TILE_INFO_SIZE;
+  std::vector<unsigned char> compacted(image.begin(),
+                                       image.begin() + dataStart);
+  // tiles sharing a payload keep sharing it, at its new position
+  std::unordered_map<uint64_t, int> moved;
+  for (int tileIndex = 0; tileIndex < file.tileCount; tileIndex++) {
+    const unsigned char *pTile;
+    int size;
+    jlcdGetTile(&file, tileIndex, &pTile, &size);
+    uint64_t span = (uint64_t)(pTile - file.pTileData) << 32 | (uint32_t)size;
+    auto found = moved.insert({span, (int)(compacted.size() - dataStart)});
+    writeInt(compacted.data() + JLCD_HEADER_SIZE +
+                 (size_t)tileIndex * JLCD_TILE_INFO_SIZE,
+             found.first->second);
+    if (found.second) {
+      compacted.insert(compacted.end(), pTile, pTile + size);
+    }
+  }
+  jlcdClose(&file);
+  image.swap(compacted);
+  return ERROR_OK;
+}
+
+int jlcdDecodeRect(const JlcdFile *pFile, const JlcdRect &rect,
+                   unsigned char *pRGBA, ptrdiff_t pitch) {
+  const int BYTES_PER_PIXEL = 4;
+  if (rect.width <= 0 || rect.height <= 0) {
+    return ERROR_INVALID_PARAM;
+  }
+  const int tileWidth = pFile->tileWidth;
+  const int tileHeight = pFile->tileHeight;
+  const int numColumns = pFile->imgWidth / tileWidth;
+  const int numRows = pFile->imgHeight / tileHeight;
+
+  // the part of the viewport covered by tiles, in image pixels
+  long long x0 = std::max(rect.x, 0);
+  long long y0 = std::max(rect.y, 0);
+  long long x1 = std::min((long long)rect.x + rect.width,
+                          (long long)numColumns * tileWidth);
+  long long y1 = std::min((long long)rect.y + rect.height,
+                          (long long)numRows * tileHeight);
+
+  // clear what no tile covers, row by row
+  for (long long y = rect.y; y < (long long)rect.y + rect.height; y++) {
+    unsigned char *pRow = pRGBA + (ptrdiff_t)(y - rect.y) * pitch;
+    if (y < y0 || y >= y1 || x0 >= x1) {
+      memset(pRow, 0, (size_t)rect.width * BYTES_PER_PIXEL);
+      continue;
+    }
+    memset(pRow, 0, (size_t)(x0 - rect.x) * BYTES_PER_PIXEL);
+    memset(pRow + (x1 - rect.x) * BYTES_PER_PIXEL, 0,
+           (size_t)(rect.x + (long long)rect.width - x1) * BYTES_PER_PIXEL);
+  }
+
+  if (x0 >= x1 || y0 >= y1) {
+    return ERROR_OK;
+  }
+
+  TileCodec *pCodec = tileCodecInit(tileWidth, tileHeight);
+  if (pCodec == NULL) {
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  unsigned char pARGB[TILE_MAX_BYTES];
+  const int tileRowBytes = tileWidth * BYTES_PER_PIXEL;
+  int ret = ERROR_OK;
+  for (long long row = y0 / tileHeight;
+       row <= (y1 - 1) / tileHeight && ret == ERROR_OK; row++) {
+    for (long long column = x0 / tileWidth; column <= (x1 - 1) / tileWidth;
+         column++) {
+      int tileIndex = row * numColumns + column;
+      const unsigned char *pTile;
+      int size;
+      if (jlcdCheckTile(pFile, tileIndex) != ERROR_OK) {
+        ret = ERROR_INVALID_INPUT_FILE;
+        break;
+      }
+      jlcdGetTile(pFile, tileIndex, &pTile, &size);
+      if (size == 0) {
+        continue;
+      }
+      // the visible part of the tile
+      long long left = std::max(column * tileWidth, x0);
+      long long right = std::min((column + 1) * tileWidth, x1);
+      long long top = std::max(row * tileHeight, y0);
+      long long bottom = std::min((row + 1) * tileHeight, y1);
+      if (right - left == tileWidth && bottom - top == tileHeight) {
+        // all of it, straight into the viewport
+        if (tile2argbToRows(pCodec, pTile, size,
+                            pRGBA + (ptrdiff_t)(top - rect.y) * pitch +
+                                (left - rect.x) * BYTES_PER_PIXEL,
+                            pitch) != 0) {
+          ret = ERROR_INVALID_INPUT_FILE;
+          break;
+        }
+        continue;
+      }
+      if (tile2argbWithCodec(pCodec, pTile, size, pARGB) != 0) {
+        ret = ERROR_INVALID_INPUT_FILE;
+        break;
+      }
+      const unsigned char *pSrc =
+          pARGB + (top - row * tileHeight) * tileRowBytes +
+          (left - column * tileWidth) * BYTES_PER_PIXEL;
+      unsigned char *pDst = pRGBA + (ptrdiff_t)(top - rect.y) * pitch +
+                            (left - rect.x) * BYTES_PER_PIXEL;
+      for (long long y = top; y < bottom; y++) {
+        memcpy(pDst, pSrc, (right - left) * BYTES_PER_PIXEL);
+        pSrc += tileRowBytes;
+        pDst += pitch;
+      }
+    }
+  }
+  tileCodecFree(pCodec);
+  return ret;
+}
@@ -1,11 +1,20 @@
 /* Compress and Decompress image data
  */
+#include "bmpFile.h"
 #include "defines.h"
+#include "jlcdFile.h"
+#include "jlcdImage.h"
 #include "rgbTileProc.h"
+#include "tileCompare.h"
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <math.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #ifdef IN_DEVELOP
 #define DEVELOP_FLAG "[dev]"
@@ -17,25 +26,288 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
 
 typedef struct _TileCompressionInfo {
   int tilePosition;
   int tileSize;
 } TileCompressionInfo;
 
+typedef struct _TileSource {
+  const unsigned char *pTop; // first pixel row of the tile rows handed out
+  ptrdiff_t pitch;           // bytes from one row to the next, < 0 bottom-up
+  int bmpOrder;              // B, G, R, A as in a BMP file, not RGBA
+  int forceOpaque;           // with bmpOrder, read every alpha as 255
+  // the previous frame in the layout of pTop, or NULL; tiles it has the
+  // same are given size 0 and not encoded
+  const unsigned char *pPrevTop;
+  // per tile, nonzero to give it size 0 without encoding it; or NULL
+  const unsigned char *pSkip;
+} TileSource;
+
+typedef struct _TileRowCompressionInfo {
+  int worker;     // whose buffer holds the row
+  int rowOffset;  // where the row starts in that buffer
+  int rowSize;    // compressed bytes of all tiles in the row
+} TileRowCompressionInfo;
+
+/*
+ * copy tile (`tileRowIndex`, `tileColumnIndex`) of `source` to `pARGB` as
+ * RGBA, one 32 byte copy per tile row
+ */
+static void gatherTile(const TileSource &source, int tileRowIndex,
+                       int tileColumnIndex, unsigned char *pARGB) {
+  const int TILE_WIDTH = 8;
+  const int TILE_HEIGHT = 8;
+  const int TILE_ROW_BYTES = TILE_WIDTH * 4;
+  const unsigned char *pSrc =
+      source.pTop + (ptrdiff_t)tileRowIndex * TILE_HEIGHT * source.pitch +
+      tileColumnIndex * TILE_ROW_BYTES;
+  for (int i = 0; i < TILE_HEIGHT; i++) {
+    memcpy(pARGB + i * TILE_ROW_BYTES, pSrc, TILE_ROW_BYTES);
+    pSrc += source.pitch;
+  }
+  if (source.bmpOrder) {
+    bmpPixelsToRGBA(pARGB, pARGB, TILE_WIDTH * TILE_HEIGHT,
+                    source.forceOpaque);
+  }
+}
+
+/*
+ * compress the tile rows handed out by `pNextRow` into `buffer`. Tile
+ * positions are stored relative to the start of their row.
+ */
+static void compressTileRows(TileSource source, int numRows,
+                             int numColumns, int nLevel, int worker,
+                             std::atomic<int> *pNextRow,
+                             std::vector<unsigned char> &buffer,
+                             TileRowCompressionInfo *pRowInfos,
+                             TileCompressionInfo *pTCInfos) {
+  const int TILE_WIDTH = 8;
+  const int TILE_HEIGHT = 8;
+  const int BYTES_PER_PIXEL = 4;
+  const int TILE_BYTES = TILE_WIDTH * TILE_HEIGHT * BYTES_PER_PIXEL;
+  const int MAX_TILE_SIZE = tileEncodeBound(TILE_WIDTH, TILE_HEIGHT, nLevel);
+  const int TILE_ROW_BYTES = TILE_WIDTH * BYTES_PER_PIXEL;
+  unsigned char pARGB[TILE_BYTES] = {0u};
+
+  TileCodec *pCodec = tileCodecInitLevel(TILE_WIDTH, TILE_HEIGHT, nLevel);
+
+  int tileRowIndex;
+  while ((tileRowIndex = pNextRow->fetch_add(1)) < numRows) {
+    int rowOffset = buffer.size();
+    int posInRow = 0;
+    buffer.resize(rowOffset + numColumns * MAX_TILE_SIZE);
+    unsigned char *pRowBuffer = buffer.data() + rowOffset;
+
+    for (int tileColumnIndex = 0; tileColumnIndex < numColumns;
+         tileColumnIndex++) {
+      int tileIndex = tileRowIndex * numColumns + tileColumnIndex;
+      ptrdiff_t tileOffset =
+          (ptrdiff_t)tileRowIndex * TILE_HEIGHT * source.pitch +
+          tileColumnIndex * TILE_ROW_BYTES;
+      pTCInfos[tileIndex].tilePosition = posInRow;
+      if ((source.pSkip != NULL && source.pSkip[tileIndex]) ||
+          (source.pPrevTop != NULL &&
+           tileEqual(source.pTop + tileOffset, source.pPrevTop + tileOffset,
+                     source.pitch, TILE_ROW_BYTES, TILE_HEIGHT))) {
+        pTCInfos[tileIndex].tileSize = 0;
+        continue;
+      }
+      gatherTile(source, tileRowIndex, tileColumnIndex, pARGB);
+
+      // compress
+      argb2tileWithCodec(pCodec, pARGB, pRowBuffer + posInRow,
+                         &pTCInfos[tileIndex].tileSize);
+      posInRow += pTCInfos[tileIndex].tileSize;
+    }
+
+    buffer.resize(rowOffset + posInRow);
+    pRowInfos[tileRowIndex].worker = worker;
+    pRowInfos[tileRowIndex].rowOffset = rowOffset;
+    pRowInfos[tileRowIndex].rowSize = posInRow;
+  }
+
+  tileCodecFree(pCodec);
+}
+
+// tiles kept for deduplication, 16 MB of 8x8 ones; later tiles are only
+// matched against these
+#define DEDUP_MAX_TILES (1 << 16)
+
+typedef struct _TileDedupEntry {
+  int prev;         // older entry with the same hash, or -1
+  int tileIndex;    // first tile with these contents
+  int tilePosition; // its payload, once written
+  int tileSize;
+} TileDedupEntry;
+
+/* tiles seen so far, by a 64-bit hash of their RGBA bytes and confirmed by
+ * comparing the bytes in full. Tiles are looked up in index order, so the
+ * payload shared is always the first one, whatever the number of threads.
+ */
+typedef struct _TileDedup {
+  std::unordered_map<uint64_t, int> newest; // hash -> newest entry
+  std::vector<TileDedupEntry> entries;
+  std::vector<unsigned char> tiles; // RGBA bytes of every entry
+  long long duplicates;
+} TileDedup;
+
+/*
+ * look up the `numRows` tile rows of `source` starting at tile `firstTile`
+ * of the image. Tile i gets entryOf[i], the entry of its contents or -1
+ * when the table is full, and skip[i], set for tiles seen before.
+ */
+static void findDuplicateTiles(TileDedup &dedup, const TileSource &source,
+                               int numRows, int numColumns, int firstTile,
+                               std::vector<int> &entryOf,
+                               std::vector<unsigned char> &skip) {
+  const int TILE_BYTES = 8 * 8 * 4;
+  unsigned char pARGB[TILE_BYTES];
+  int tileCount = numRows * numColumns;
+  entryOf.assign(tileCount, -1);
+  skip.assign(tileCount, 0);
+  for (int tileIndex = 0; tileIndex < tileCount; tileIndex++) {
+    gatherTile(source, tileIndex / numColumns, tileIndex % numColumns, pARGB);
+    uint64_t hash = tileHash64(pARGB, TILE_BYTES);
+    auto found = dedup.newest.find(hash);
+    int entry = found != dedup.newest.end() ? found->second : -1;
+    while (entry >= 0 && memcmp(dedup.tiles.data() + (size_t)entry * TILE_BYTES,
+                                pARGB, TILE_BYTES) != 0) {
+      entry = dedup.entries[entry].prev;
+    }
+    if (entry >= 0) {
+      entryOf[tileIndex] = entry;
+      skip[tileIndex] = 1;
+      dedup.duplicates++;
+    } else if (dedup.entries.size() < DEDUP_MAX_TILES) {
+      TileDedupEntry newEntry = {
+          found != dedup.newest.end() ? found->second : -1,
+          firstTile + tileIndex, -1, 0};
+      entryOf[tileIndex] = dedup.entries.size();
+      dedup.newest[hash] = entryOf[tileIndex];
+      dedup.entries.push_back(newEntry);
+      dedup.tiles.insert(dedup.tiles.end(), pARGB, pARGB + TILE_BYTES);
+    }
+  }
+}
+
+/*
+ * once the tiles of a batch have their file positions: remember those of
+ * new entries and point every repeated tile at its first payload
+ */
+static void resolveDuplicateTiles(TileDedup &dedup,
+                                  const std::vector<int> &entryOf,
+                                  const std::vector<unsigned char> &skip,
+                                  TileCompressionInfo *pTCInfos) {
+  for (size_t tileIndex = 0; tileIndex < entryOf.size(); tileIndex++) {
+    if (entryOf[tileIndex] < 0) {
+      continue;
+    }
+    TileDedupEntry &entry = dedup.entries[entryOf[tileIndex]];
+    if (skip[tileIndex]) {
+      // the first tile is earlier in index order, so already resolved
+      pTCInfos[tileIndex].tilePosition = entry.tilePosition;
+      pTCInfos[tileIndex].tileSize = entry.tileSize;
+    } else {
+      entry.tilePosition = pTCInfos[tileIndex].tilePosition;
+      entry.tileSize = pTCInfos[tileIndex].tileSize;
+    }
+  }
+}
+
+// per worker compressed tile rows
+typedef std::vector<std::vector<unsigned char>> WorkerBuffers;
+
+/*
+ * compress `numRows` tile rows of `source` with `nThreads` workers; row i
+ * ends up in workerBuffers[pRowInfos[i].worker]
+ */
+static void compressBatch(TileSource source, int numRows, int numColumns,
+                          int nLevel, int nThreads,
+                          WorkerBuffers &workerBuffers,
+                          TileRowCompressionInfo *pRowInfos,
+                          TileCompressionInfo *pTCInfos) {
+  nThreads = std::min(nThreads, numRows);
+  std::atomic<int> nextRow(0);
+  std::vector<std::thread> workers;
+  for (int worker = 0; worker < nThreads; worker++) {
+    workerBuffers[worker].clear();
+  }
+  for (int worker = 1; worker < nThreads; worker++) {
+    workers.emplace_back(compressTileRows, source, numRows, numColumns, nLevel,
+                         worker, &nextRow, std::ref(workerBuffers[worker]),
+                         pRowInfos, pTCInfos);
+  }
+  compressTileRows(source, numRows, numColumns, nLevel, 0, &nextRow,
+                   workerBuffers[0], pRowInfos, pTCInfos);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+/*
+ * write the index entries of `numTiles` tiles starting at `firstTile`; the
+ * stream is left at the end of the index entries written
+ */
+static void writeTileIndex(std::ofstream &ofs, int nVersion, int firstTile,
+                           int numTiles, const TileCompressionInfo *pTCInfos) {
+  if (nVersion == 2) {
+    // tile len only; the tiles follow back to back in index order
+    std::vector<uint16_t> tileSizes(numTiles);
+    for (int i = 0; i < numTiles; i++) {
+      tileSizes[i] = pTCInfos[i].tileSize;
+    }
+    ofs.seekp(JLCD_HEADER_SIZE + (std::streamoff)firstTile *
+                                     JLCD_V2_TILE_INFO_SIZE);
+    ofs.write(reinterpret_cast<const char *>(tileSizes.data()),
+              numTiles * JLCD_V2_TILE_INFO_SIZE);
+  } else {
+    // tile data offset + len
+    ofs.seekp(JLCD_HEADER_SIZE + (std::streamoff)firstTile *
+                                     JLCD_TILE_INFO_SIZE);
+    for (int i = 0; i < numTiles; i++) {
+      ofs.write(reinterpret_cast<const char *>(&pTCInfos[i].tilePosition), 4);
+      ofs.write(reinterpret_cast<const char *>(&pTCInfos[i].tileSize), 4);
+    }
+  }
+}
+
 /*
  * compress ARGB data to TILE
+ *  nThreads -- number of worker threads, 0 for one per core. The output
+ *              does not depend on it.
+ *  nLevel   -- compression level, one of TILE_LEVEL_*
+ *  nVersion -- JLCD format version, 1 (level 0 only) or 2 (see jlcdFile.h)
+ *  nDedup   -- nonzero to store repeated tiles once, all their index
+ *              entries pointing at it; format 1, so level 0, only
+ *
+ * Uncompressed 24/32 bit BMP files are streamed a few tile rows at a time;
+ * 32 bit ones are mapped and their tiles gathered from the file as stored,
+ * 24 bit ones are converted a strip at a time. Other inputs are loaded
+ * whole by stbi_load(). Either way the index is patched in as the rows are
+ * written.
  */
-int compressARGB(char const *inFileName, char const *outFileName) {
-  int ret = ERROR_OK;
+int compressARGB(char const *inFileName, char const *outFileName,
+                 int nThreads, int nLevel, int nVersion, int nDedup) {
+  if (nVersion == 1 && nLevel != TILE_LEVEL_COMPAT) {
+    // older readers would take uniform and stored tiles for token streams
+    std::cout << "ERROR: format 1 needs level 0" << std::endl;
+    return ERROR_INVALID_PARAM;
+  }
   int width, height, nrChannels;
-  unsigned char *data =
-      stbi_load(inFileName, &width, &height, &nrChannels, STBI_rgb_alpha);
-  if (data == NULL) {
-    std::cout << "cannot open file: " << inFileName << std::endl;
-    return ERROR_INPUT_FILE;
+  unsigned char *data = NULL;
+  BmpFile bmp;
+  bool streaming = bmpOpen(&bmp, inFileName) == ERROR_OK;
+  if (streaming) {
+    width = bmp.width;
+    height = bmp.height;
+    nrChannels = bmp.channels;
+  } else {
+    data = stbi_load(inFileName, &width, &height, &nrChannels, STBI_rgb_alpha);
+    if (data == NULL) {
+      std::cout << "cannot open file: " << inFileName << std::endl;
+      return ERROR_INPUT_FILE;
+    }
   }
   std::cout << "image info: width = " << width << ", height = " << height
             << ", channels = " << nrChannels << std::endl;
@@ -45,181 +317,561 @@ int compressARGB(char const *inFileName, char const *outFileName) {
   int numRows = height / TILE_HEIGHT;
   int numColumns = width / TILE_WIDTH;
   const int BYTES_PER_PIXEL = 4;
-  int rowStride = width * BYTES_PER_PIXEL; // 4 bytes per pixel
-  unsigned char pARGB[TILE_WIDTH * TILE_HEIGHT * BYTES_PER_PIXEL] = {0u};
-  unsigned char pCompressed[TILE_WIDTH * TILE_HEIGHT * BYTES_PER_PIXEL] = {0u};
 
-  tileSetSize(TILE_WIDTH, TILE_HEIGHT);
+  std::ofstream ofs;
+  ofs.open(outFileName, std::ios::binary | std::ios::out);
+  if (!ofs.is_open()) {
+    std::cout << "fail to open output file(" << outFileName << ")" << std::endl;
+    if (streaming) {
+      bmpClose(&bmp);
+    } else {
+      stbi_image_free(data);
+    }
+    return ERROR_OUTPUT_FILE;
+  }
+
+  if (nThreads <= 0) {
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  nThreads = std::max(1, std::min(nThreads, numRows));
 
-  unsigned char *pCompressionBuffer =
-      new unsigned char[numRows * numColumns * TILE_WIDTH * TILE_HEIGHT *
-                        BYTES_PER_PIXEL];
-  if (NULL == pCompressionBuffer) {
-    return ERROR_CUSTOM;
+  // a batch gives every worker one tile row when streaming; a loaded image
+  // is a single batch
+  int batchRows = streaming ? nThreads : std::max(1, numRows);
+  // mapped 32 bit pixels need no strip
+  bool direct = streaming && bmp.bitsPerPixel == 32 &&
+                bmpRowPointer(&bmp, 0) != NULL;
+  std::vector<unsigned char> strip;
+  if (streaming && !direct) {
+    strip.resize((size_t)batchRows * TILE_HEIGHT * width * BYTES_PER_PIXEL);
   }
-  TileCompressionInfo *pTCInfos = new TileCompressionInfo[numRows * numColumns];
-  if (NULL == pTCInfos) {
-    delete[] pCompressionBuffer;
-    return ERROR_CUSTOM;
+  TileCompressionInfo *pTCInfos =
+      new TileCompressionInfo[batchRows * numColumns];
+  TileRowCompressionInfo *pRowInfos = new TileRowCompressionInfo[batchRows];
+
+  // header and a zeroed index, filled in batch by batch
+  int tileCount = numRows * numColumns;
+  int tileInfoSize =
+      nVersion == 2 ? JLCD_V2_TILE_INFO_SIZE : JLCD_TILE_INFO_SIZE;
+  ofs.write(nVersion == 2 ? JLCD_V2_MAGIC : JLCD_MAGIC, 4);
+  ofs.write(reinterpret_cast<const char *>(&width), 4);
+  ofs.write(reinterpret_cast<const char *>(&height), 4);
+  ofs.write(reinterpret_cast<const char *>(&TILE_WIDTH), 4);
+  ofs.write(reinterpret_cast<const char *>(&TILE_HEIGHT), 4);
+  ofs.write(reinterpret_cast<const char *>(&tileCount), 4);
+  std::vector<char> zeros((size_t)numColumns * tileInfoSize);
+  for (int tileRowIndex = 0; tileRowIndex < numRows; tileRowIndex++) {
+    ofs.write(zeros.data(), zeros.size());
   }
+  std::streamoff dataEnd = ofs.tellp();
 
-  int tileRowIndex = 0;
-  int tileColumnIndex = 0;
-  int totalBitsAfterCompression = 0;
+  // every worker compresses whole tile rows into its own buffer
+  WorkerBuffers workerBuffers(nThreads);
+  TileDedup dedup;
+  dedup.duplicates = 0;
+  std::vector<int> dedupEntryOf;
+  std::vector<unsigned char> dedupSkip;
+  int ret = ERROR_OK;
   int posInCompressionBuffer = 0;
-  unsigned char *pClr = NULL;
-
-  for (tileRowIndex = 0; tileRowIndex < numRows; tileRowIndex++) {
-    for (tileColumnIndex = 0; tileColumnIndex < numColumns; tileColumnIndex++) {
-      int tileIndex = tileRowIndex * numColumns + tileColumnIndex;
-      pClr = pARGB;
-      for (int i = 0; i < TILE_HEIGHT; i++) {
-        for (int j = 0; j < TILE_WIDTH; j++) {
-          int row = tileRowIndex * TILE_HEIGHT + i;
-          int col = tileColumnIndex * TILE_WIDTH + j;
-          int pixelDataOffset = rowStride * row + col * BYTES_PER_PIXEL;
-          pClr[0] = data[pixelDataOffset];     // b
-          pClr[1] = data[pixelDataOffset + 1]; // g
-          pClr[2] = data[pixelDataOffset + 2]; // r
-          pClr[3] = data[pixelDataOffset + 3]; // a
-          pClr += 4;
-        }
+  for (int firstRow = 0; firstRow < numRows; firstRow += batchRows) {
+    int rows = std::min(batchRows, numRows - firstRow);
+    TileSource source = {NULL, (ptrdiff_t)width * BYTES_PER_PIXEL, 0, 0,
+                         NULL, NULL};
+    if (direct) {
+      source.pTop = bmpRowPointer(&bmp, firstRow * TILE_HEIGHT);
+      source.pitch = bmpRowPitch(&bmp);
+      source.bmpOrder = 1;
+      source.forceOpaque = !bmp.hasAlpha || bmp.forceOpaque;
+    } else if (streaming) {
+      ret = bmpReadRows(&bmp, firstRow * TILE_HEIGHT, rows * TILE_HEIGHT,
+                        strip.data());
+      if (ret != ERROR_OK) {
+        std::cout << "cannot read file: " << inFileName << std::endl;
+        break;
       }
-      pTCInfos[tileIndex].tilePosition = posInCompressionBuffer;
-
-      // compress
-      argb2tile(pARGB, pCompressionBuffer + posInCompressionBuffer,
-                &pTCInfos[tileIndex].tileSize);
-      posInCompressionBuffer += pTCInfos[tileIndex].tileSize;
+      source.pTop = strip.data();
+    } else {
+      source.pTop =
+          data + (size_t)firstRow * TILE_HEIGHT * width * BYTES_PER_PIXEL;
     }
-  }
-  std::cout << "compression ratio = "
-            << (float)posInCompressionBuffer /
-                   (float)(width * height * BYTES_PER_PIXEL) * 100
-            << "%" << std::endl;
 
-  // save compressed data to JLCD file
-  std::ofstream ofs;
-  ofs.open(outFileName, std::ios::binary | std::ios::out);
+    if (nDedup) {
+      findDuplicateTiles(dedup, source, rows, numColumns,
+                         firstRow * numColumns, dedupEntryOf, dedupSkip);
+      source.pSkip = dedupSkip.data();
+    }
+    compressBatch(source, rows, numColumns, nLevel, nThreads, workerBuffers,
+                  pRowInfos, pTCInfos);
 
-  int tileCount = numRows * numColumns;
-  int fileHeaderSize = 24;
-  int tileInfoSize = tileCount * 8;
-  int dataOffsetInFile = fileHeaderSize + tileInfoSize;
-  if (ofs.is_open()) {
-    ofs.write("JLCD", 4);
-    ofs.write(reinterpret_cast<const char *>(&width), 4);
-    ofs.write(reinterpret_cast<const char *>(&height), 4);
-    ofs.write(reinterpret_cast<const char *>(&TILE_WIDTH), 4);
-    ofs.write(reinterpret_cast<const char *>(&TILE_HEIGHT), 4);
-    ofs.write(reinterpret_cast<const char *>(&tileCount), 4);
-    // tile data offset + len
-    for (tileRowIndex = 0; tileRowIndex < numRows; tileRowIndex++) {
-      for (tileColumnIndex = 0; tileColumnIndex < numColumns;
+    // prefix sum over the rows turns row-relative positions into file
+    // offsets
+    for (int tileRowIndex = 0; tileRowIndex < rows; tileRowIndex++) {
+      for (int tileColumnIndex = 0; tileColumnIndex < numColumns;
            tileColumnIndex++) {
         int tileIndex = tileRowIndex * numColumns + tileColumnIndex;
-        ofs.write(
-            reinterpret_cast<const char *>(&pTCInfos[tileIndex].tilePosition),
-            4);
-        ofs.write(reinterpret_cast<const char *>(&pTCInfos[tileIndex].tileSize),
-                  4);
+        pTCInfos[tileIndex].tilePosition += posInCompressionBuffer;
       }
+      posInCompressionBuffer += pRowInfos[tileRowIndex].rowSize;
+    }
+    if (nDedup) {
+      resolveDuplicateTiles(dedup, dedupEntryOf, dedupSkip, pTCInfos);
+    }
+
+    writeTileIndex(ofs, nVersion, firstRow * numColumns, rows * numColumns,
+                   pTCInfos);
+    // tile data, row by row from the worker buffers
+    ofs.seekp(dataEnd);
+    for (int tileRowIndex = 0; tileRowIndex < rows; tileRowIndex++) {
+      const TileRowCompressionInfo &rowInfo = pRowInfos[tileRowIndex];
+      ofs.write(reinterpret_cast<const char *>(
+                    workerBuffers[rowInfo.worker].data() + rowInfo.rowOffset),
+                rowInfo.rowSize);
+    }
+    dataEnd = ofs.tellp();
+    if (streaming) {
+      bmpReleaseRows(&bmp, firstRow * TILE_HEIGHT, rows * TILE_HEIGHT);
     }
-    ofs.flush();
-    // all tile data
-    ofs.write(reinterpret_cast<const char *>(pCompressionBuffer),
-              posInCompressionBuffer);
-    ofs.close();
-  } else {
-    std::cout << "fail to open output file(" << outFileName << ")" << std::endl;
+  }
+  ofs.close();
+  if (ret != ERROR_OK) {
+    // no image with part of its index zeroed
+    remove(outFileName);
   }
 
-  stbi_image_free(data);
-  delete[] pCompressionBuffer;
+  if (ret == ERROR_OK && nDedup) {
+    std::cout << "duplicate tiles = " << dedup.duplicates << "/" << tileCount
+              << std::endl;
+  }
+  if (ret == ERROR_OK) {
+    std::cout << "compression ratio = "
+              << (float)posInCompressionBuffer /
+                     (float)(width * height * BYTES_PER_PIXEL) * 100
+              << "%" << std::endl;
+  }
+
+  if (streaming) {
+    bmpClose(&bmp);
+  } else {
+    stbi_image_free(data);
+  }
   delete[] pTCInfos;
-  return ERROR_OK;
+  delete[] pRowInfos;
+  return ret;
 }
 
+typedef struct _TileTarget {
+  unsigned char *pTop; // first pixel row of the image
+  ptrdiff_t pitch;     // bytes from one row to the next, < 0 bottom-up
+  int bmpOrder;        // write B, G, R, A as in a BMP file, not RGBA
+} TileTarget;
+
 /*
- * decompress TILE data to ARGB
+ * decompress the tile rows handed out by `pNextRow` into the image.
+ * Tile data is read straight from the mapped file.
  */
-int decompressARGB(char const *compressedFileName, char const *outFileName) {
-  std::ifstream ifs;
-  ifs.open(compressedFileName, std::ios::binary | std::ios::in);
+static int decompressTileRows(const JlcdFile *pFile, const TileCodec *pCodec,
+                              std::atomic<int> *pNextRow, TileTarget target) {
+  const int BYTES_PER_PIXEL = 4;
+  const int tileWidth = pCodec->nTileWidth;
+  const int tileHeight = pCodec->nTileHeight;
+  const int tileRowBytes = tileWidth * BYTES_PER_PIXEL;
+  int tileRowCount = pFile->imgHeight / tileHeight;
+  int tileColumnCount = pFile->imgWidth / tileWidth;
+
+  int ret = ERROR_OK;
+  int row;
+  while (ret == ERROR_OK && (row = pNextRow->fetch_add(1)) < tileRowCount) {
+    for (int col = 0; col < tileColumnCount; col++) {
+      int tileIndex = row * tileColumnCount + col;
+      const unsigned char *pTile = NULL;
+      int tileDataBytes = 0;
+      jlcdGetTile(pFile, tileIndex, &pTile, &tileDataBytes);
+      if (tileDataBytes == 0) {
+        // a sequence frame keeps the tile of the previous one
+        continue;
+      }
+      // decompress straight into the image
+      unsigned char *pDst = target.pTop +
+                            (ptrdiff_t)row * tileHeight * target.pitch +
+                            col * tileRowBytes;
+      if (tile2argbToRows(pCodec, pTile, tileDataBytes, pDst,
+                          target.pitch) != 0) {
+        ret = ERROR_INVALID_INPUT_FILE;
+        break;
+      }
+      if (target.bmpOrder) {
+        for (int i = 0; i < tileHeight; i++) {
+          bmpPixelsToRGBA(pDst, pDst, tileWidth, 0);
+          pDst += target.pitch;
+        }
+      }
+    }
+  }
+
+  if (ret != ERROR_OK) {
+    // stop the other workers early
+    pNextRow->store(tileRowCount);
+  }
+  return ret;
+}
+
+/*
+ * decompress all tiles of the selected frame of `pFile` into `target`
+ *  nThreads -- number of worker threads, 0 for one per core
+ */
+static int decompressTiles(const JlcdFile *pFile, const TileCodec *pCodec,
+                           int nThreads, TileTarget target) {
+  int tileRowCount = pFile->imgHeight / pCodec->nTileHeight;
+  if (nThreads <= 0) {
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  nThreads = std::max(1, std::min(nThreads, tileRowCount));
+
+  // tiles are independent, so every worker decodes whole tile rows straight
+  // into the output image
+  std::atomic<int> nextRow(0);
+  std::vector<int> workerResults(nThreads, ERROR_OK);
+  std::vector<std::thread> workers;
+  for (int worker = 1; worker < nThreads; worker++) {
+    workers.emplace_back([&, worker]() {
+      workerResults[worker] =
+          decompressTileRows(pFile, pCodec, &nextRow, target);
+    });
+  }
+  workerResults[0] = decompressTileRows(pFile, pCodec, &nextRow, target);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+  int ret = ERROR_OK;
+  for (int result : workerResults) {
+    if (result != ERROR_OK) {
+      ret = result;
+    }
+  }
+  return ret;
+}
 
-  if (!ifs.is_open()) {
+/*
+ * decompress TILE data to ARGB
+ *  nThreads -- number of worker threads, 0 for one per core
+ */
+int decompressARGB(char const *compressedFileName, char const *outFileName,
+                   int nThreads) {
+  int ret = ERROR_OK;
+  JlcdFile file;
+  ret = jlcdOpen(&file, compressedFileName);
+  if (ret == ERROR_INPUT_FILE) {
     std::cout << "fail to open output file: " << compressedFileName
               << std::endl;
     return ERROR_OUTPUT_FILE;
-  }
-
-  char readBuffer[1024];
-  // read "JLCD"
-  ifs.read(readBuffer, 4);
-  if (strncmp(readBuffer, "JLCD", 4) != 0) {
-    ifs.close();
+  } else if (ret != ERROR_OK) {
     std::cout << "ERROR: INVALID tile file: " << compressedFileName
               << std::endl;
     return ERROR_INVALID_INPUT_FILE;
   }
 
-  const int BYTES_PER_PIXEL = 4;
-  int imgWidth, imgHeight, tileWidth, tileHeight, tileCount;
-  // read image width
-  ifs.read(reinterpret_cast<char *>(&imgWidth), 4);
-  ifs.read(reinterpret_cast<char *>(&imgHeight), 4);
-  ifs.read(reinterpret_cast<char *>(&tileWidth), 4);
-  ifs.read(reinterpret_cast<char *>(&tileHeight), 4);
-  ifs.read(reinterpret_cast<char *>(&tileCount), 4);
+  int imgWidth = file.imgWidth;
+  int imgHeight = file.imgHeight;
+  int tileWidth = file.tileWidth;
+  int tileHeight = file.tileHeight;
 
   std::cout << "imgWidth = " << imgWidth << ", imgHeight = " << imgHeight
             << ", tileWidth = " << tileWidth << ", tileHeight = " << tileHeight
             << std::endl;
 
-  int tileRowCount = imgHeight / tileHeight;
-  int tileColumnCount = imgWidth / tileWidth;
-  int tileDataStartPos = 24 + 8 * tileCount;
-  unsigned char *pDecompressedARGB =
-      new unsigned char[imgWidth * imgHeight * 4];
-  unsigned char pTempDecompressionBuffer[1024];
+  TileCodec *pCodec = tileCodecInit(tileWidth, tileHeight);
+  if (pCodec == NULL) {
+    jlcdClose(&file);
+    std::cout << "ERROR: INVALID tile file: " << compressedFileName
+              << std::endl;
+    return ERROR_INVALID_INPUT_FILE;
+  }
 
-  for (int row = 0; row < tileRowCount; row++) {
-    for (int col = 0; col < tileColumnCount; col++) {
-      int tileIndex = row * tileColumnCount + col;
-      int tileInfoOffset = 24 + 8 * tileIndex;
-      int tileDataOffset = 0;
-      int tileDataBytes = 0;
-      ifs.seekg(tileInfoOffset);
-      ifs.read(reinterpret_cast<char *>(&tileDataOffset), 4);
-      ifs.read(reinterpret_cast<char *>(&tileDataBytes), 4);
-      ifs.seekg(tileDataStartPos + tileDataOffset);
-      ifs.read(readBuffer, tileDataBytes);
-      // decompress
-      tile2argb((unsigned char *)readBuffer, tileDataBytes,
-                pTempDecompressionBuffer);
-
-      for (int i = 0; i < tileHeight; i++) {
-        for (int j = 0; j < tileWidth; j++) {
-          int globalRow = row * tileHeight + i;
-          int globalCol = col * tileWidth + j;
-          int indexInTile = i * tileWidth + j;
-          memcpy(&pDecompressedARGB[(globalRow * imgWidth + globalCol) *
-                                    BYTES_PER_PIXEL],
-                 &pTempDecompressionBuffer[indexInTile * BYTES_PER_PIXEL], 4);
-        }
-      }
-    }
+  // decode straight into the mapped output file where possible, into an
+  // image written out afterwards otherwise; pixels outside the tiles are 0
+  BmpFile outFile;
+  unsigned char *pDecompressedARGB = NULL;
+  TileTarget target;
+  if (bmpCreate(&outFile, outFileName, imgWidth, imgHeight) == ERROR_OK) {
+    target.pTop = bmpMutableRow(&outFile, 0);
+    target.pitch = bmpRowPitch(&outFile);
+    target.bmpOrder = 1;
+  } else {
+    pDecompressedARGB = new unsigned char[(size_t)imgWidth * imgHeight * 4]();
+    target.pTop = pDecompressedARGB;
+    target.pitch = (ptrdiff_t)imgWidth * 4;
+    target.bmpOrder = 0;
   }
-  ifs.close();
 
-  // save decompressed image to output file
-  stbi_write_bmp(outFileName, imgWidth, imgHeight, STBI_rgb_alpha,
-                 reinterpret_cast<char const *>(pDecompressedARGB));
+  ret = decompressTiles(&file, pCodec, nThreads, target);
+  tileCodecFree(pCodec);
+  jlcdClose(&file);
 
+  if (ret != ERROR_OK) {
+    std::cout << "ERROR: corrupted tile data in: " << compressedFileName
+              << std::endl;
+  }
+  if (pDecompressedARGB == NULL) {
+    bmpClose(&outFile);
+    if (ret != ERROR_OK) {
+      // no partial image
+      remove(outFileName);
+    }
+  } else if (ret == ERROR_OK) {
+    // save decompressed image to output file
+    ret = bmpWrite(outFileName, imgWidth, imgHeight, pDecompressedARGB);
+    if (ret != ERROR_OK) {
+      std::cout << "fail to open output file(" << outFileName << ")"
+                << std::endl;
+    }
+  }
   delete[] pDecompressedARGB;
+  return ret;
+}
+
+/*
+ * decompress the `roi` rectangle of TILE data to a `roi.width` x
+ * `roi.height` BMP; only the tiles it touches are read and decoded
+ */
+int decompressRect(char const *compressedFileName, char const *outFileName,
+                   const JlcdRect &roi) {
+  JlcdFile file;
+  int ret = jlcdOpenHeader(&file, compressedFileName);
+  if (ret == ERROR_INPUT_FILE) {
+    std::cout << "fail to open output file: " << compressedFileName
+              << std::endl;
+    return ERROR_OUTPUT_FILE;
+  } else if (ret != ERROR_OK) {
+    std::cout << "ERROR: INVALID tile file: " << compressedFileName
+              << std::endl;
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  std::cout << "imgWidth = " << file.imgWidth
+            << ", imgHeight = " << file.imgHeight << ", roi = " << roi.x << ","
+            << roi.y << "," << roi.width << "," << roi.height << std::endl;
+  if (roi.x >= file.imgWidth || roi.y >= file.imgHeight ||
+      (long long)roi.x + roi.width <= 0 ||
+      (long long)roi.y + roi.height <= 0) {
+    jlcdClose(&file);
+    std::cout << "ERROR: roi is outside the image" << std::endl;
+    return ERROR_INVALID_PARAM;
+  }
+  // the viewport may hang over the edges, but is no larger than the image
+  if (roi.width > file.imgWidth || roi.height > file.imgHeight ||
+      !bmpWriteFits(roi.width, roi.height)) {
+    jlcdClose(&file);
+    std::cout << "ERROR: roi is larger than the image" << std::endl;
+    return ERROR_INVALID_PARAM;
+  }
+
+  std::vector<unsigned char> viewport((size_t)roi.width * roi.height * 4);
+  ret = jlcdDecodeRect(&file, roi, viewport.data(), (ptrdiff_t)roi.width * 4);
+  jlcdClose(&file);
+  if (ret != ERROR_OK) {
+    std::cout << "ERROR: corrupted tile data in: " << compressedFileName
+              << std::endl;
+    return ret;
+  }
+  ret = bmpWrite(outFileName, roi.width, roi.height, viewport.data());
+  if (ret != ERROR_OK) {
+    std::cout << "fail to open output file(" << outFileName << ")"
+              << std::endl;
+  }
+  return ret;
+}
+
+/*
+ * load a whole image as RGBA rows, the layout of
+ * stbi_load(..., STBI_rgb_alpha)
+ */
+static int loadRGBA(char const *fileName, std::vector<unsigned char> &image,
+                    int *pWidth, int *pHeight) {
+  BmpFile bmp;
+  if (bmpOpen(&bmp, fileName) == ERROR_OK) {
+    *pWidth = bmp.width;
+    *pHeight = bmp.height;
+    image.resize((size_t)bmp.width * bmp.height * 4);
+    int ret = bmpReadRows(&bmp, 0, bmp.height, image.data());
+    bmpClose(&bmp);
+    return ret;
+  }
+  int channels;
+  unsigned char *data =
+      stbi_load(fileName, pWidth, pHeight, &channels, STBI_rgb_alpha);
+  if (data == NULL) {
+    return ERROR_INPUT_FILE;
+  }
+  image.assign(data, data + (size_t)*pWidth * *pHeight * 4);
+  stbi_image_free(data);
   return ERROR_OK;
 }
 
+/*
+ * compress images of one size to a JLCD sequence, one frame each. Tiles
+ * equal to the previous frame's are stored as size 0 without encoding.
+ *  nThreads -- number of worker threads, 0 for one per core
+ *  nLevel   -- compression level, one of TILE_LEVEL_*
+ */
+int compressSequence(const std::vector<char const *> &inFileNames,
+                     char const *outFileName, int nThreads, int nLevel) {
+  const int TILE_WIDTH = 8;
+  const int TILE_HEIGHT = 8;
+  const int BYTES_PER_PIXEL = 4;
+  std::ofstream ofs;
+  ofs.open(outFileName, std::ios::binary | std::ios::out);
+  if (!ofs.is_open()) {
+    std::cout << "fail to open output file(" << outFileName << ")" << std::endl;
+    return ERROR_OUTPUT_FILE;
+  }
+
+  int ret = ERROR_OK;
+  int width = 0, height = 0, numRows = 0, numColumns = 0, tileCount = 0;
+  std::vector<unsigned char> frame, prevFrame;
+  std::vector<TileCompressionInfo> tcInfos;
+  std::vector<TileRowCompressionInfo> rowInfos;
+  std::vector<uint16_t> tileSizes;
+  WorkerBuffers workerBuffers;
+  long long totalSize = 0;
+  int frameCount = inFileNames.size();
+  for (int f = 0; f < frameCount; f++) {
+    int frameWidth, frameHeight;
+    if (loadRGBA(inFileNames[f], frame, &frameWidth, &frameHeight) !=
+        ERROR_OK) {
+      std::cout << "cannot open file: " << inFileNames[f] << std::endl;
+      ret = ERROR_INPUT_FILE;
+      break;
+    }
+    if (f == 0) {
+      width = frameWidth;
+      height = frameHeight;
+      numRows = height / TILE_HEIGHT;
+      numColumns = width / TILE_WIDTH;
+      tileCount = numRows * numColumns;
+      tcInfos.resize(tileCount);
+      rowInfos.resize(numRows);
+      tileSizes.resize(tileCount);
+      if (nThreads <= 0) {
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+      }
+      nThreads = std::max(1, std::min(nThreads, numRows));
+      workerBuffers.resize(nThreads);
+      std::cout << "image info: width = " << width << ", height = " << height
+                << ", frames = " << frameCount << std::endl;
+
+      ofs.write(JLCD_SEQ_MAGIC, 4);
+      ofs.write(reinterpret_cast<const char *>(&width), 4);
+      ofs.write(reinterpret_cast<const char *>(&height), 4);
+      ofs.write(reinterpret_cast<const char *>(&TILE_WIDTH), 4);
+      ofs.write(reinterpret_cast<const char *>(&TILE_HEIGHT), 4);
+      ofs.write(reinterpret_cast<const char *>(&tileCount), 4);
+      ofs.write(reinterpret_cast<const char *>(&frameCount), 4);
+    } else if (frameWidth != width || frameHeight != height) {
+      std::cout << "ERROR: frame size differs: " << inFileNames[f]
+                << std::endl;
+      ret = ERROR_INVALID_INPUT_FILE;
+      break;
+    }
+
+    TileSource source = {frame.data(), (ptrdiff_t)width * BYTES_PER_PIXEL, 0,
+                         0, f > 0 ? prevFrame.data() : NULL, NULL};
+    compressBatch(source, numRows, numColumns, nLevel, nThreads,
+                  workerBuffers, rowInfos.data(), tcInfos.data());
+
+    // frame size, tile len only, then the tiles back to back
+    int changedTiles = 0;
+    uint32_t frameSize = tileCount * JLCD_V2_TILE_INFO_SIZE;
+    for (int tileIndex = 0; tileIndex < tileCount; tileIndex++) {
+      tileSizes[tileIndex] = tcInfos[tileIndex].tileSize;
+      changedTiles += tileSizes[tileIndex] != 0;
+    }
+    for (int tileRowIndex = 0; tileRowIndex < numRows; tileRowIndex++) {
+      frameSize += rowInfos[tileRowIndex].rowSize;
+    }
+    ofs.write(reinterpret_cast<const char *>(&frameSize), 4);
+    ofs.write(reinterpret_cast<const char *>(tileSizes.data()),
+              tileCount * JLCD_V2_TILE_INFO_SIZE);
+    for (int tileRowIndex = 0; tileRowIndex < numRows; tileRowIndex++) {
+      const TileRowCompressionInfo &rowInfo = rowInfos[tileRowIndex];
+      ofs.write(reinterpret_cast<const char *>(
+                    workerBuffers[rowInfo.worker].data() + rowInfo.rowOffset),
+                rowInfo.rowSize);
+    }
+    totalSize += JLCD_FRAME_HEADER_SIZE + frameSize;
+    std::cout << "frame " << f << ": changed tiles = " << changedTiles << "/"
+              << tileCount << ", size = " << frameSize << std::endl;
+    std::swap(frame, prevFrame);
+  }
+  ofs.close();
+
+  if (ret != ERROR_OK) {
+    // no sequence with missing frames
+    remove(outFileName);
+    return ret;
+  }
+  std::cout << "compression ratio = "
+            << (float)totalSize /
+                   ((float)width * height * BYTES_PER_PIXEL * frameCount) * 100
+            << "%" << std::endl;
+  return ERROR_OK;
+}
+
+/*
+ * decompress every frame of a JLCD sequence to `<outPrefix>.<frame>.bmp`
+ *  nThreads -- number of worker threads, 0 for one per core
+ */
+int decompressSequence(char const *compressedFileName, char const *outPrefix,
+                       int nThreads) {
+  JlcdFile file;
+  int ret = jlcdOpen(&file, compressedFileName);
+  if (ret == ERROR_INPUT_FILE) {
+    std::cout << "fail to open output file: " << compressedFileName
+              << std::endl;
+    return ERROR_OUTPUT_FILE;
+  } else if (ret != ERROR_OK) {
+    std::cout << "ERROR: INVALID tile file: " << compressedFileName
+              << std::endl;
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  TileCodec *pCodec = tileCodecInit(file.tileWidth, file.tileHeight);
+  if (pCodec == NULL) {
+    jlcdClose(&file);
+    std::cout << "ERROR: INVALID tile file: " << compressedFileName
+              << std::endl;
+    return ERROR_INVALID_INPUT_FILE;
+  }
+  std::cout << "imgWidth = " << file.imgWidth
+            << ", imgHeight = " << file.imgHeight
+            << ", frames = " << file.frameCount << std::endl;
+
+  // one image for all frames, so that kept tiles are already in place
+  std::vector<unsigned char> image((size_t)file.imgWidth * file.imgHeight * 4);
+  TileTarget target = {image.data(), (ptrdiff_t)file.imgWidth * 4, 0};
+  std::vector<char> outFileName(strlen(outPrefix) + 16);
+  for (int f = 0; f < file.frameCount && ret == ERROR_OK; f++) {
+    ret = jlcdSelectFrame(&file, f);
+    if (ret == ERROR_OK) {
+      ret = decompressTiles(&file, pCodec, nThreads, target);
+    }
+    if (ret != ERROR_OK) {
+      std::cout << "ERROR: corrupted tile data in: " << compressedFileName
+                << ", frame " << f << std::endl;
+      ret = ERROR_INVALID_INPUT_FILE;
+      break;
+    }
+    snprintf(outFileName.data(), outFileName.size(), "%s.%d.bmp", outPrefix,
+             f);
+    ret = bmpWrite(outFileName.data(), file.imgWidth, file.imgHeight,
+                   image.data());
+    if (ret != ERROR_OK) {
+      std::cout << "fail to open output file(" << outFileName.data() << ")"
+                << std::endl;
+    }
+  }
+  tileCodecFree(pCodec);
+  jlcdClose(&file);
+  return ret;
+}
+
 /*
  * compare two bmp files
  */
@@ -277,10 +929,19 @@ int main(int argc, char *argv[]) {
   int func = 0;
   char const *inFileName = NULL;
   char const *outFileName = NULL;
+  std::vector<char const *> frameFileNames; // -es
   int IsNewBuff = 0;
+  int nThreads = 1;
+  int nLevel = TILE_LEVEL_COMPAT;
+  int nVersion = 0; // picked from the level unless given
+  int nDedup = 0;
+  JlcdRect roi = {0, 0, 0, 0}; // -de --roi, whole image when empty
   int ret = ERROR_OK;
 
-#define USAGE "USAGE: fblcd.out [--version] [-{en,de,cp} infile outfile]"
+#define USAGE                                                                  \
+  "USAGE: fblcd.out [--version] [-{en,de,cp} infile outfile] "                \
+  "[-es outfile frame...] [-ds infile prefix] [-j threads] [-l level] "       \
+  "[-f format] [-d] [--roi x,y,w,h]"
 
   if (argc < 2) {
     std::cout << USAGE << std::endl;
@@ -306,9 +967,53 @@ int main(int argc, char *argv[]) {
     std::cout << "                           if `outfile` parameter is not "
                  "specified, it will assigned to `infile` and add BMP suffix"
               << std::endl;
+    std::cout << "  --roi x,y,w,h          decode only the w x h pixels at "
+                 "(x, y) for -de, reading"
+              << std::endl;
+    std::cout << "                           just the tiles they touch"
+              << std::endl;
     std::cout << "  -cp infile outfile     compare `infile` and `outfile`, "
                  "pixel by pixel"
               << std::endl;
+    std::cout << "  -es outfile frame...   encode BMP frames of one size to "
+                 "the sequence `outfile`,"
+              << std::endl;
+    std::cout << "                           tiles unchanged from the "
+                 "previous frame are not stored again"
+              << std::endl;
+    std::cout << "  -ds infile prefix      decode every frame of the "
+                 "sequence `infile` to"
+              << std::endl;
+    std::cout << "                           `prefix`.N.bmp (default prefix: "
+                 "`infile`)"
+              << std::endl;
+    std::cout << "  -j threads             number of worker threads for -en "
+                 "and -de, 0 for one per core (default: 1)"
+              << std::endl;
+    std::cout << "  -l level               compression level for -en and -es:"
+              << std::endl;
+    std::cout << "                           0 -- original encoder (default)"
+              << std::endl;
+    std::cout << "                           1 -- fastest" << std::endl;
+    std::cout << "                           2 -- greedy" << std::endl;
+    std::cout << "                           3 -- lazy" << std::endl;
+    std::cout << "                           4 -- optimal, smallest and "
+                 "slowest"
+              << std::endl;
+    std::cout << "                           with -en, levels above 0 need "
+                 "format 2, read only"
+              << std::endl;
+    std::cout << "                           by this version's decoder"
+              << std::endl;
+    std::cout << "  -f format              JLCD format version for -en: 1 "
+                 "(level 0 only, read by"
+              << std::endl;
+    std::cout << "                           every version) or 2 (default: "
+                 "1 at level 0, 2 above)"
+              << std::endl;
+    std::cout << "  -d                     store repeated tiles once for -en, "
+                 "in format 1 at level 0"
+              << std::endl;
     return ERROR_PARAM_NOT_ENOUGH;
   }
 
@@ -324,18 +1029,90 @@ int main(int argc, char *argv[]) {
     func = 2;
   } else if (strcmp(argv[1], "-cp") == 0) {
     func = 3;
+  } else if (strcmp(argv[1], "-es") == 0) {
+    func = 4;
+  } else if (strcmp(argv[1], "-ds") == 0) {
+    func = 5;
   } else {
     return ERROR_INVALID_PARAM;
   }
 
-  if (argc < 3) {
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0) {
+      if (i + 1 >= argc) {
+        std::cout << "ERROR: parameter is not enough!" << std::endl;
+        return ERROR_PARAM_NOT_ENOUGH;
+      }
+      nThreads = atoi(argv[++i]);
+      if (nThreads < 0) {
+        std::cout << "ERROR: invalid thread count: " << argv[i] << std::endl;
+        return ERROR_INVALID_PARAM;
+      }
+    } else if (strcmp(argv[i], "-l") == 0) {
+      if (i + 1 >= argc) {
+        std::cout << "ERROR: parameter is not enough!" << std::endl;
+        return ERROR_PARAM_NOT_ENOUGH;
+      }
+      nLevel = atoi(argv[++i]);
+      if (nLevel < TILE_LEVEL_COMPAT || nLevel > TILE_LEVEL_OPTIMAL) {
+        std::cout << "ERROR: invalid level: " << argv[i] << std::endl;
+        return ERROR_INVALID_PARAM;
+      }
+    } else if (strcmp(argv[i], "-f") == 0) {
+      if (i + 1 >= argc) {
+        std::cout << "ERROR: parameter is not enough!" << std::endl;
+        return ERROR_PARAM_NOT_ENOUGH;
+      }
+      nVersion = atoi(argv[++i]);
+      if (nVersion != 1 && nVersion != 2) {
+        std::cout << "ERROR: invalid format: " << argv[i] << std::endl;
+        return ERROR_INVALID_PARAM;
+      }
+    } else if (strcmp(argv[i], "-d") == 0) {
+      nDedup = 1;
+    } else if (strcmp(argv[i], "--roi") == 0) {
+      if (i + 1 >= argc) {
+        std::cout << "ERROR: parameter is not enough!" << std::endl;
+        return ERROR_PARAM_NOT_ENOUGH;
+      }
+      char end;
+      if (sscanf(argv[++i], "%d,%d,%d,%d%c", &roi.x, &roi.y, &roi.width,
+                 &roi.height, &end) != 4 ||
+          roi.width <= 0 || roi.height <= 0) {
+        std::cout << "ERROR: invalid roi: " << argv[i] << std::endl;
+        return ERROR_INVALID_PARAM;
+      }
+    } else if (func == 4) {
+      frameFileNames.push_back(argv[i]);
+    } else if (inFileName == NULL) {
+      inFileName = argv[i];
+    } else if (outFileName == NULL) {
+      outFileName = argv[i];
+    } else {
+      std::cout << "ERROR: unknown parameter: " << argv[i] << std::endl;
+      return ERROR_INVALID_PARAM;
+    }
+  }
+
+  if (func == 4) {
+    // compress a sequence
+    if (frameFileNames.size() < 2) {
+      std::cout << "ERROR: parameter is not enough!" << std::endl;
+      return ERROR_PARAM_NOT_ENOUGH;
+    }
+    outFileName = frameFileNames[0];
+    frameFileNames.erase(frameFileNames.begin());
+    ret = compressSequence(frameFileNames, outFileName, nThreads, nLevel);
+    std::cout << "result = " << ret << std::endl;
+    return ret;
+  }
+  if (inFileName == NULL) {
     std::cout << "ERROR: parameter is not enough!" << std::endl;
     return ERROR_PARAM_NOT_ENOUGH;
   }
-  inFileName = argv[2];
-  if (argc >= 4) {
-    outFileName = argv[3];
-  } else {
+  if (outFileName == NULL && func == 5) {
+    outFileName = inFileName;
+  } else if (outFileName == NULL) {
     IsNewBuff = 1;
     outFileName = new char[strlen(inFileName) + 6];
     sprintf((char *)outFileName, "%s.%s", inFileName,
@@ -346,10 +1123,29 @@ int main(int argc, char *argv[]) {
 
   if (func == 1) {
     // compress
-    ret = compressARGB(inFileName, outFileName);
+    if (nDedup && (nVersion == 2 || nLevel != TILE_LEVEL_COMPAT)) {
+      std::cout << "ERROR: -d needs format 1 and level 0" << std::endl;
+      return ERROR_INVALID_PARAM;
+    }
+    if (nVersion == 1 && nLevel != TILE_LEVEL_COMPAT) {
+      std::cout << "ERROR: format 1 needs level 0" << std::endl;
+      return ERROR_INVALID_PARAM;
+    }
+    if (nVersion == 0) {
+      nVersion = nLevel == TILE_LEVEL_COMPAT ? 1 : 2;
+    }
+    ret = compressARGB(inFileName, outFileName, nThreads, nLevel, nVersion,
+                       nDedup);
   } else if (func == 2) {
     // decompress
-    ret = decompressARGB(inFileName, outFileName);
+    if (roi.width > 0) {
+      ret = decompressRect(inFileName, outFileName, roi);
+    } else {
+      ret = decompressARGB(inFileName, outFileName, nThreads);
+    }
+  } else if (func == 5) {
+    // decompress a sequence
+    ret = decompressSequence(inFileName, outFileName, nThreads);
   } else {
     ret = compareBMP(inFileName, outFileName);
   }
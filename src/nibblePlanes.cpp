@@ -0,0 +1,250 @@
+/* nibblePlanes.cpp
+ *  scalar and SIMD kernels for the nibble-plane transform, picked once at
+ *  run time from what the CPU supports
+ */
+#include "nibblePlanes.h"
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define NIBBLE_PLANES_X86 1
+#endif
+
+static void splitNibblesScalar(const unsigned char *pClrBlk,
+                               unsigned char *pLow, unsigned char *pHigh,
+                               int nBytes) {
+  for (int i = 0; i < nBytes; i += 2) {
+    *pLow++ = (pClrBlk[i] << 4) | (pClrBlk[i + 1] & 15);
+    *pHigh++ = (pClrBlk[i] & 0xf0) | (pClrBlk[i + 1] >> 4);
+  }
+}
+
+static void mergeNibblesScalar(const unsigned char *pLow,
+                               const unsigned char *pHigh,
+                               unsigned char *pClrBlk, int nBytes) {
+  for (int i = 0; i < nBytes; i += 2) {
+    pClrBlk[i] = (*pLow >> 4) | (*pHigh & 0xf0);
+    pClrBlk[i + 1] = (*pLow & 15) | (*pHigh << 4);
+    ++pLow;
+    ++pHigh;
+  }
+}
+
+// the merge of `nBytes` bytes as rows of `rowBytes`, `pitch` bytes apart
+static void mergeRowsScalar(const unsigned char *pLow,
+                            const unsigned char *pHigh, unsigned char *pDst,
+                            ptrdiff_t pitch, int rowBytes, int nBytes) {
+  for (int i = 0; i < nBytes; i += rowBytes) {
+    mergeNibblesScalar(pLow + i / 2, pHigh + i / 2, pDst, rowBytes);
+    pDst += pitch;
+  }
+}
+
+#ifdef NIBBLE_PLANES_X86
+// Both kernels treat a byte pair (a, b) as the 16-bit lane x = a | b << 8.
+// Split computes the low plane byte as (x << 4 & 0xf0) | (x >> 8 & 0x0f)
+// and the high one as (x & 0xf0) | x >> 12, then packs the lanes to bytes.
+// Merge interleaves a low and a high plane byte into x = l | h << 8 and
+// rebuilds the pair with four shifts and masks.
+
+__attribute__((target("sse2"))) static void
+splitNibblesSse2(const unsigned char *pClrBlk, unsigned char *pLow,
+                 unsigned char *pHigh, int nBytes) {
+  const __m128i mask0f = _mm_set1_epi16(0x000f);
+  const __m128i maskf0 = _mm_set1_epi16(0x00f0);
+  int i = 0;
+  for (; i + 32 <= nBytes; i += 32) {
+    __m128i x0 = _mm_loadu_si128((const __m128i *)(pClrBlk + i));
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(pClrBlk + i + 16));
+    __m128i low0 =
+        _mm_or_si128(_mm_and_si128(_mm_slli_epi16(x0, 4), maskf0),
+                     _mm_and_si128(_mm_srli_epi16(x0, 8), mask0f));
+    __m128i low1 =
+        _mm_or_si128(_mm_and_si128(_mm_slli_epi16(x1, 4), maskf0),
+                     _mm_and_si128(_mm_srli_epi16(x1, 8), mask0f));
+    __m128i high0 =
+        _mm_or_si128(_mm_and_si128(x0, maskf0), _mm_srli_epi16(x0, 12));
+    __m128i high1 =
+        _mm_or_si128(_mm_and_si128(x1, maskf0), _mm_srli_epi16(x1, 12));
+    _mm_storeu_si128((__m128i *)(pLow + i / 2), _mm_packus_epi16(low0, low1));
+    _mm_storeu_si128((__m128i *)(pHigh + i / 2),
+                     _mm_packus_epi16(high0, high1));
+  }
+  splitNibblesScalar(pClrBlk + i, pLow + i / 2, pHigh + i / 2, nBytes - i);
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+mergeLanesSse2(__m128i x) {
+  return _mm_or_si128(
+      _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 4), _mm_set1_epi16(0x000f)),
+                   _mm_and_si128(_mm_srli_epi16(x, 8), _mm_set1_epi16(0x00f0))),
+      _mm_or_si128(_mm_and_si128(_mm_slli_epi16(x, 8), _mm_set1_epi16(0x0f00)),
+                   _mm_and_si128(_mm_slli_epi16(x, 4),
+                                 _mm_set1_epi16((short)0xf000))));
+}
+
+__attribute__((target("sse2"))) static void
+mergeNibblesSse2(const unsigned char *pLow, const unsigned char *pHigh,
+                 unsigned char *pClrBlk, int nBytes) {
+  int i = 0;
+  for (; i + 32 <= nBytes; i += 32) {
+    __m128i low = _mm_loadu_si128((const __m128i *)(pLow + i / 2));
+    __m128i high = _mm_loadu_si128((const __m128i *)(pHigh + i / 2));
+    _mm_storeu_si128((__m128i *)(pClrBlk + i),
+                     mergeLanesSse2(_mm_unpacklo_epi8(low, high)));
+    _mm_storeu_si128((__m128i *)(pClrBlk + i + 16),
+                     mergeLanesSse2(_mm_unpackhi_epi8(low, high)));
+  }
+  mergeNibblesScalar(pLow + i / 2, pHigh + i / 2, pClrBlk + i, nBytes - i);
+}
+
+__attribute__((target("sse2"))) static void
+mergeRowsSse2(const unsigned char *pLow, const unsigned char *pHigh,
+              unsigned char *pDst, ptrdiff_t pitch, int rowBytes, int nBytes) {
+  for (int i = 0; i < nBytes; i += rowBytes) {
+    mergeNibblesSse2(pLow + i / 2, pHigh + i / 2, pDst, rowBytes);
+    pDst += pitch;
+  }
+}
+
+__attribute__((target("avx2"))) static void
+splitNibblesAvx2(const unsigned char *pClrBlk, unsigned char *pLow,
+                 unsigned char *pHigh, int nBytes) {
+  const __m256i mask0f = _mm256_set1_epi16(0x000f);
+  const __m256i maskf0 = _mm256_set1_epi16(0x00f0);
+  int i = 0;
+  for (; i + 64 <= nBytes; i += 64) {
+    __m256i x0 = _mm256_loadu_si256((const __m256i *)(pClrBlk + i));
+    __m256i x1 = _mm256_loadu_si256((const __m256i *)(pClrBlk + i + 32));
+    __m256i low0 =
+        _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(x0, 4), maskf0),
+                        _mm256_and_si256(_mm256_srli_epi16(x0, 8), mask0f));
+    __m256i low1 =
+        _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(x1, 4), maskf0),
+                        _mm256_and_si256(_mm256_srli_epi16(x1, 8), mask0f));
+    __m256i high0 = _mm256_or_si256(_mm256_and_si256(x0, maskf0),
+                                    _mm256_srli_epi16(x0, 12));
+    __m256i high1 = _mm256_or_si256(_mm256_and_si256(x1, maskf0),
+                                    _mm256_srli_epi16(x1, 12));
+    // packus works per 128-bit lane, so put the quarters back in order
+    _mm256_storeu_si256(
+        (__m256i *)(pLow + i / 2),
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(low0, low1),
+                                 _MM_SHUFFLE(3, 1, 2, 0)));
+    _mm256_storeu_si256(
+        (__m256i *)(pHigh + i / 2),
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(high0, high1),
+                                 _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+  splitNibblesSse2(pClrBlk + i, pLow + i / 2, pHigh + i / 2, nBytes - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+mergeLanesAvx2(__m256i x) {
+  return _mm256_or_si256(
+      _mm256_or_si256(
+          _mm256_and_si256(_mm256_srli_epi16(x, 4), _mm256_set1_epi16(0x000f)),
+          _mm256_and_si256(_mm256_srli_epi16(x, 8),
+                           _mm256_set1_epi16(0x00f0))),
+      _mm256_or_si256(
+          _mm256_and_si256(_mm256_slli_epi16(x, 8), _mm256_set1_epi16(0x0f00)),
+          _mm256_and_si256(_mm256_slli_epi16(x, 4),
+                           _mm256_set1_epi16((short)0xf000))));
+}
+
+__attribute__((target("avx2"))) static void
+mergeNibblesAvx2(const unsigned char *pLow, const unsigned char *pHigh,
+                 unsigned char *pClrBlk, int nBytes) {
+  int i = 0;
+  for (; i + 64 <= nBytes; i += 64) {
+    __m256i low = _mm256_loadu_si256((const __m256i *)(pLow + i / 2));
+    __m256i high = _mm256_loadu_si256((const __m256i *)(pHigh + i / 2));
+    // unpack works per 128-bit lane: `first` holds pairs 0-7 and 16-23,
+    // `second` pairs 8-15 and 24-31
+    __m256i first = mergeLanesAvx2(_mm256_unpacklo_epi8(low, high));
+    __m256i second = mergeLanesAvx2(_mm256_unpackhi_epi8(low, high));
+    _mm256_storeu_si256((__m256i *)(pClrBlk + i),
+                        _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i *)(pClrBlk + i + 32),
+                        _mm256_permute2x128_si256(first, second, 0x31));
+  }
+  mergeNibblesSse2(pLow + i / 2, pHigh + i / 2, pClrBlk + i, nBytes - i);
+}
+
+__attribute__((target("avx2"))) static void
+mergeRowsAvx2(const unsigned char *pLow, const unsigned char *pHigh,
+              unsigned char *pDst, ptrdiff_t pitch, int rowBytes, int nBytes) {
+  if (rowBytes == nBytes) {
+    mergeNibblesAvx2(pLow, pHigh, pDst, nBytes);
+    return;
+  }
+  if (rowBytes % 32 != 0 || nBytes % 64 != 0) {
+    mergeRowsSse2(pLow, pHigh, pDst, pitch, rowBytes, nBytes);
+    return;
+  }
+  // as mergeNibblesAvx2, each 32 byte half stored within its row
+  for (int i = 0; i < nBytes; i += 64) {
+    __m256i low = _mm256_loadu_si256((const __m256i *)(pLow + i / 2));
+    __m256i high = _mm256_loadu_si256((const __m256i *)(pHigh + i / 2));
+    __m256i first = mergeLanesAvx2(_mm256_unpacklo_epi8(low, high));
+    __m256i second = mergeLanesAvx2(_mm256_unpackhi_epi8(low, high));
+    unsigned char *pFirst = pDst + i / rowBytes * pitch + i % rowBytes;
+    unsigned char *pSecond =
+        pDst + (i + 32) / rowBytes * pitch + (i + 32) % rowBytes;
+    _mm256_storeu_si256((__m256i *)pFirst,
+                        _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256((__m256i *)pSecond,
+                        _mm256_permute2x128_si256(first, second, 0x31));
+  }
+}
+#endif
+
+typedef void (*SplitKernel)(const unsigned char *, unsigned char *,
+                            unsigned char *, int);
+typedef void (*MergeKernel)(const unsigned char *, const unsigned char *,
+                            unsigned char *, int);
+typedef void (*MergeRowsKernel)(const unsigned char *, const unsigned char *,
+                                unsigned char *, ptrdiff_t, int, int);
+
+typedef struct _NibbleKernels {
+  SplitKernel split;
+  MergeKernel merge;
+  MergeRowsKernel mergeRows;
+  const char *name;
+} NibbleKernels;
+
+static NibbleKernels selectKernels() {
+#ifdef NIBBLE_PLANES_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {splitNibblesAvx2, mergeNibblesAvx2, mergeRowsAvx2, "avx2"};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return {splitNibblesSse2, mergeNibblesSse2, mergeRowsSse2, "sse2"};
+  }
+#endif
+  return {splitNibblesScalar, mergeNibblesScalar, mergeRowsScalar, "scalar"};
+}
+
+static const NibbleKernels &kernels() {
+  static const NibbleKernels s_kernels = selectKernels();
+  return s_kernels;
+}
+
+void splitNibbles(const unsigned char *pClrBlk, unsigned char *pPlanes,
+                  int nBytes) {
+  kernels().split(pClrBlk, pPlanes, pPlanes + nBytes / 2, nBytes);
+}
+
+void mergeNibbles(const unsigned char *pPlanes, unsigned char *pClrBlk,
+                  int nBytes) {
+  kernels().merge(pPlanes, pPlanes + nBytes / 2, pClrBlk, nBytes);
+}
+
+void mergeNibblesToRows(const unsigned char *pPlanes, unsigned char *pDst,
+                        ptrdiff_t pitch, int rowBytes, int nBytes) {
+  kernels().mergeRows(pPlanes, pPlanes + nBytes / 2, pDst, pitch, rowBytes,
+                      nBytes);
+}
+
+const char *nibblePlanesKernelName() { return kernels().name; }
@@ -12,15 +12,183 @@
 
 #include "decode.h"
 #include "encode.h"
+#include "nibblePlanes.h"
+#include "tileEncoder.h"
+#include "uniformTile.h"
 
 int g_nTileWidth = 0;
 int g_nTileHeight = 0;
 
+static int isValidTileSize(int nTileWidth, int nTileHeight) {
+  // divided, so that no product overflows
+  return nTileWidth > 0 && nTileHeight > 0 &&
+         nTileWidth <= TILE_MAX_BYTES / 4 / nTileHeight;
+}
+
 void tileSetSize(int nTileWidth, int nTileHeight) {
+  assert(isValidTileSize(nTileWidth, nTileHeight));
   g_nTileWidth = nTileWidth;
   g_nTileHeight = nTileHeight;
 }
 
+TileCodec *tileCodecInit(int nTileWidth, int nTileHeight) {
+  return tileCodecInitLevel(nTileWidth, nTileHeight, TILE_LEVEL_COMPAT);
+}
+
+TileCodec *tileCodecInitLevel(int nTileWidth, int nTileHeight, int nLevel) {
+  if (!isValidTileSize(nTileWidth, nTileHeight) ||
+      nLevel < TILE_LEVEL_COMPAT || nLevel > TILE_LEVEL_OPTIMAL) {
+    return NULL;
+  }
+  bool compact = nLevel != TILE_LEVEL_COMPAT;
+  TileCodec *pCodec = (TileCodec *)malloc(sizeof(TileCodec));
+  pCodec->nTileWidth = nTileWidth;
+  pCodec->nTileHeight = nTileHeight;
+  pCodec->nLevel = nLevel;
+  pCodec->pEncodeContext =
+      compact ? EncodeContext_initCompact(nTileWidth * nTileHeight * 4)
+              : EncodeContext_init();
+  pCodec->pTileEncoder =
+      createTileEncoder(nTileWidth, nTileHeight, compact, nLevel);
+  return pCodec;
+}
+
+void tileCodecFree(TileCodec *pCodec) {
+  if (pCodec != NULL) {
+    EncodeContext_free(pCodec->pEncodeContext);
+    delete pCodec->pTileEncoder;
+    free(pCodec);
+  }
+}
+
+// token stream of `nBytes` bytes that compress worst: all literals, plus
+// one header byte per 32 literals
+#define MAX_LZ_BYTES(nBytes) ((nBytes) + ((nBytes) + 31) / 32)
+
+int tileEncodeBound(int nTileWidth, int nTileHeight, int nLevel) {
+  int nBytes = nTileWidth * nTileHeight * 4;
+  return nLevel == TILE_LEVEL_COMPAT ? MAX_LZ_BYTES(nBytes) : nBytes + 1;
+}
+
+/* keep the token stream if it is smaller than the tile, otherwise store
+ * the tile behind TILE_STORED_MARKER
+ */
+static void emitTile(int nBytes, const unsigned char *pClrBlk,
+                     const unsigned char *pEncoded, int nEncodedSize,
+                     unsigned char *pTile, int *pTileSize) {
+  if (nEncodedSize > nBytes) {
+    pTile[0] = TILE_STORED_MARKER;
+    memcpy(pTile + 1, pClrBlk, nBytes);
+    *pTileSize = nBytes + 1;
+  } else {
+    memcpy(pTile, pEncoded, nEncodedSize);
+    *pTileSize = nEncodedSize;
+  }
+}
+
+static int encodeTile(EncodeContext *pContext, int nBytes,
+                      const unsigned char *pClrBlk, unsigned char *pTile,
+                      int *pTileSize) {
+  unsigned char reorderd_clr_blk[TILE_MAX_BYTES];
+  splitNibbles(pClrBlk, reorderd_clr_blk, nBytes);
+  return EncodeContext_encode(pContext, pTile, pTileSize, reorderd_clr_blk,
+                              nBytes);
+}
+
+/* decode a tile of `nBytes` bytes as rows of `rowBytes`, `pitch` bytes
+ * apart at `pDst`; the token stream is merged from its nibble planes
+ * straight into the rows
+ */
+static int decodeTileRows(int rowBytes, int nBytes, const unsigned char *pTile,
+                          int nTileSize, unsigned char *pDst,
+                          ptrdiff_t pitch) {
+  if (nTileSize == UNIFORM_TILE_SIZE) {
+    for (int i = 0; i < nBytes; i += rowBytes) {
+      tileFillUniform(pDst, pTile, rowBytes);
+      pDst += pitch;
+    }
+    return 0;
+  }
+  if (nTileSize > 0 && pTile[0] == TILE_STORED_MARKER) {
+    if (nTileSize != nBytes + 1) {
+      return -1;
+    }
+    for (int i = 0; i < nBytes; i += rowBytes) {
+      memcpy(pDst, pTile + 1 + i, rowBytes);
+      pDst += pitch;
+    }
+    return 0;
+  }
+  unsigned char reorderd_clr_blk[TILE_MAX_BYTES + DECODE_SLACK];
+  if (decodeSafe(pTile, nTileSize, reorderd_clr_blk, nBytes + DECODE_SLACK) !=
+      nBytes) {
+    return -1;
+  }
+  mergeNibblesToRows(reorderd_clr_blk, pDst, pitch, rowBytes, nBytes);
+  return 0;
+}
+
+static int decodeTile(int nBytes, const unsigned char *pTile, int nTileSize,
+                      unsigned char *pClrBlk) {
+  return decodeTileRows(nBytes, nBytes, pTile, nTileSize, pClrBlk, nBytes);
+}
+
+int argb2tileWithCodec(TileCodec *pCodec, const unsigned char *pClrBlk,
+                       unsigned char *pTile, int *pTileSize) {
+  const int nBytes = pCodec->nTileWidth * pCodec->nTileHeight * 4;
+  if (pCodec->nLevel == TILE_LEVEL_COMPAT) {
+    // token streams only, as the original encoder wrote them
+    if (pCodec->pTileEncoder != NULL) {
+      unsigned char reorderd_clr_blk[TILE_MAX_BYTES];
+      splitNibbles(pClrBlk, reorderd_clr_blk, nBytes);
+      *pTileSize = pCodec->pTileEncoder->encode(reorderd_clr_blk, pTile);
+      return 0;
+    }
+    return encodeTile(pCodec->pEncodeContext, nBytes, pClrBlk, pTile,
+                      pTileSize);
+  }
+
+  if (tileIsUniform(pClrBlk, nBytes)) {
+    memcpy(pTile, pClrBlk, UNIFORM_TILE_SIZE);
+    *pTileSize = UNIFORM_TILE_SIZE;
+    return 0;
+  }
+  // the token stream may be larger than the tile, so it goes to a scratch
+  // buffer and only the output that is kept is copied
+  unsigned char encoded[MAX_LZ_BYTES(TILE_MAX_BYTES)];
+  int nEncodedSize = 0;
+  if (pCodec->pTileEncoder != NULL) {
+    unsigned char reorderd_clr_blk[TILE_MAX_BYTES];
+    splitNibbles(pClrBlk, reorderd_clr_blk, nBytes);
+    nEncodedSize = pCodec->pTileEncoder->encode(reorderd_clr_blk, encoded);
+  } else if (encodeTile(pCodec->pEncodeContext, nBytes, pClrBlk, encoded,
+                        &nEncodedSize) != 0) {
+    return -1;
+  }
+  emitTile(nBytes, pClrBlk, encoded, nEncodedSize, pTile, pTileSize);
+  return 0;
+}
+
+int tile2argbWithCodec(const TileCodec *pCodec, const unsigned char *pTile,
+                       int nTileSize, unsigned char *pClrBlk) {
+  return decodeTile(pCodec->nTileWidth * pCodec->nTileHeight * 4, pTile,
+                    nTileSize, pClrBlk);
+}
+
+int tile2argbToRows(const TileCodec *pCodec, const unsigned char *pTile,
+                    int nTileSize, unsigned char *pDst, ptrdiff_t pitch) {
+  const int rowBytes = pCodec->nTileWidth * 4;
+  return decodeTileRows(rowBytes, rowBytes * pCodec->nTileHeight, pTile,
+                        nTileSize, pDst, pitch);
+}
+
+// encoder state used by argb2tile(), one per thread
+struct ThreadEncodeContext {
+  EncodeContext *pContext = EncodeContext_init();
+  ~ThreadEncodeContext() { EncodeContext_free(pContext); }
+};
+static thread_local ThreadEncodeContext t_encodeContext;
+
 /* compress ARGB data to tile
  *  param:
  *    pClrBlk      -- IN, pixel's ARGB data
@@ -33,33 +201,12 @@ void tileSetSize(int nTileWidth, int nTileHeight) {
 int argb2tile(const unsigned char *pClrBlk, unsigned char *pTile,
               int *pTileSize) {
   assert(g_nTileWidth > 0 && g_nTileHeight > 0);
-
-  unsigned char *reorderd_clr_blk = (unsigned char *)malloc(
-      g_nTileWidth * g_nTileHeight * 4 * sizeof(unsigned char));
-  memset(reorderd_clr_blk, 0, g_nTileHeight * g_nTileWidth * 4);
-  unsigned char *p = reorderd_clr_blk;
-
-  for (int i = 0; i < g_nTileHeight * g_nTileWidth * 4; ++i) {
-    if (i % 2 == 0) {
-      *p |= pClrBlk[i] << 4;
-    } else {
-      *p |= pClrBlk[i] & 15;
-      ++p;
-    }
-  }
-
-  for (int i = 0; i < g_nTileHeight * g_nTileWidth * 4; ++i) {
-    if (i % 2 == 0) {
-      *p |= pClrBlk[i] & 0xf0;
-    } else {
-      *p |= pClrBlk[i] >> 4;
-      ++p;
-    }
+  // tileSetSize() only asserts, which release builds leave out
+  if (!isValidTileSize(g_nTileWidth, g_nTileHeight)) {
+    return -1;
   }
-
-  int result = encode(pTile, pTileSize, reorderd_clr_blk);
-  free(reorderd_clr_blk);
-  return result;
+  return encodeTile(t_encodeContext.pContext, g_nTileWidth * g_nTileHeight * 4,
+                    pClrBlk, pTile, pTileSize);
 }
 
 /* decompress tile data to ARGB
@@ -73,24 +220,10 @@ int argb2tile(const unsigned char *pClrBlk, unsigned char *pTile,
  */
 int tile2argb(const unsigned char *pTile, int nTileSize,
               unsigned char *pClrBlk) {
-  g_nTileWidth = 8;
-  g_nTileHeight = 8;
-
-  unsigned char *reorderd_clr_blk = (unsigned char *)malloc(
-      g_nTileWidth * g_nTileHeight * 4 * sizeof(unsigned char));
-  // memset(reorderd_clr_blk, 0, g_nTileWidth * g_nTileHeight * 4);
-  int result = decode(pTile, nTileSize, reorderd_clr_blk);
-  unsigned char *p = reorderd_clr_blk;
-  unsigned int half_size = g_nTileWidth * g_nTileHeight * 4 / 2;
-
-  for (int i = 0; i < g_nTileWidth * g_nTileHeight * 4; ++i) {
-    if (i % 2 == 0) {
-      pClrBlk[i] = (*p >> 4) | (*(p + half_size) & 0xf0);
-    } else {
-      pClrBlk[i] = (*p & 15) | (*(p + half_size) << 4);
-      ++p;
-    }
+  // 8x8 unless the caller set a geometry with tileSetSize()
+  if (g_nTileWidth > 0 && !isValidTileSize(g_nTileWidth, g_nTileHeight)) {
+    return -1;
   }
-  free(reorderd_clr_blk);
-  return result;
+  int nBytes = g_nTileWidth > 0 ? g_nTileWidth * g_nTileHeight * 4 : 8 * 8 * 4;
+  return decodeTile(nBytes, pTile, nTileSize, pClrBlk);
 }
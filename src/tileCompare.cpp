@@ -0,0 +1,125 @@
+/* tileCompare.cpp
+ *  equality of strided tiles, 16 or 32 bytes of a row at a time, and
+ *  hashing of tile contents
+ */
+#include "tileCompare.h"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TILE_COMPARE_X86 1
+#endif
+
+static int tileEqualPlain(const unsigned char *pA, const unsigned char *pB,
+                          ptrdiff_t pitch, int rowBytes, int rows) {
+  for (int i = 0; i < rows; i++) {
+    if (memcmp(pA, pB, rowBytes) != 0) {
+      return 0;
+    }
+    pA += pitch;
+    pB += pitch;
+  }
+  return 1;
+}
+
+// differences are or-ed together and tested once per tile
+#ifdef TILE_COMPARE_X86
+__attribute__((target("sse2"))) static int
+tileEqualSse2(const unsigned char *pA, const unsigned char *pB,
+              ptrdiff_t pitch, int rowBytes, int rows) {
+  if (rowBytes % 16 != 0) {
+    return tileEqualPlain(pA, pB, pitch, rowBytes, rows);
+  }
+  __m128i diff = _mm_setzero_si128();
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < rowBytes; j += 16) {
+      __m128i a = _mm_loadu_si128((const __m128i *)(pA + j));
+      __m128i b = _mm_loadu_si128((const __m128i *)(pB + j));
+      diff = _mm_or_si128(diff, _mm_xor_si128(a, b));
+    }
+    pA += pitch;
+    pB += pitch;
+  }
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) ==
+         0xffff;
+}
+
+__attribute__((target("avx2"))) static int
+tileEqualAvx2(const unsigned char *pA, const unsigned char *pB,
+              ptrdiff_t pitch, int rowBytes, int rows) {
+  if (rowBytes % 32 != 0) {
+    return tileEqualSse2(pA, pB, pitch, rowBytes, rows);
+  }
+  __m256i diff = _mm256_setzero_si256();
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < rowBytes; j += 32) {
+      __m256i a = _mm256_loadu_si256((const __m256i *)(pA + j));
+      __m256i b = _mm256_loadu_si256((const __m256i *)(pB + j));
+      diff = _mm256_or_si256(diff, _mm256_xor_si256(a, b));
+    }
+    pA += pitch;
+    pB += pitch;
+  }
+  return _mm256_testz_si256(diff, diff);
+}
+#endif
+
+typedef int (*TileEqualKernel)(const unsigned char *, const unsigned char *,
+                               ptrdiff_t, int, int);
+
+// picked once from what the CPU supports
+static TileEqualKernel selectTileEqual() {
+#ifdef TILE_COMPARE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return tileEqualAvx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return tileEqualSse2;
+  }
+#endif
+  return tileEqualPlain;
+}
+
+int tileEqual(const unsigned char *pA, const unsigned char *pB,
+              ptrdiff_t pitch, int rowBytes, int rows) {
+  static const TileEqualKernel s_kernel = selectTileEqual();
+  return s_kernel(pA, pB, pitch, rowBytes, rows);
+}
+
+// the primes and lane round of xxHash64
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3 0x165667B19E3779F9ULL
+
+static inline uint64_t rotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t hashRound(uint64_t lane, uint64_t word) {
+  return rotateLeft(lane + word * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+uint64_t tileHash64(const unsigned char *pData, int nBytes) {
+  uint64_t lanes[4] = {HASH_PRIME1 + HASH_PRIME2, HASH_PRIME2, 0,
+                       0 - HASH_PRIME1};
+  int i = 0;
+  for (; i + 32 <= nBytes; i += 32) {
+    for (int lane = 0; lane < 4; lane++) {
+      uint64_t word;
+      memcpy(&word, pData + i + 8 * lane, 8);
+      lanes[lane] = hashRound(lanes[lane], word);
+    }
+  }
+  uint64_t hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) +
+                  rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18) +
+                  (uint64_t)nBytes;
+  for (; i < nBytes; i++) {
+    hash = rotateLeft(hash ^ (pData[i] * HASH_PRIME3), 11) * HASH_PRIME1;
+  }
+  // spread the high bits down, so that any bits can index a table
+  hash ^= hash >> 33;
+  hash *= HASH_PRIME2;
+  hash ^= hash >> 29;
+  return hash;
+}
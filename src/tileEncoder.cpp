@@ -0,0 +1,38 @@
+/* tileEncoder.cpp
+ *  instantiations of the specialized tile encoders
+ */
+#include "tileEncoder.h"
+
+// slot entries for the lazy and optimal parses, and how many of them each
+// one searches: 4 already catches most older matches (say, the same pixel
+// one row up), the optimal parse can afford all of them
+#define SEARCH_WAYS 8
+#define LAZY_SEARCH_DEPTH 4
+
+/* kCompactBits follows the sizing of EncodeContext_initCompact() */
+template <int kTileWidth, int kTileHeight, int kCompactBits>
+static TileEncoderBase *createFor(bool compact, int level) {
+  if (compact && level >= TILE_LEVEL_LAZY) {
+    return new TileEncoder<kTileWidth, kTileHeight, kCompactBits, true,
+                           SEARCH_WAYS>(
+        level, level == TILE_LEVEL_LAZY ? LAZY_SEARCH_DEPTH : SEARCH_WAYS);
+  }
+  if (compact) {
+    return new TileEncoder<kTileWidth, kTileHeight, kCompactBits, true>(level);
+  }
+  return new TileEncoder<kTileWidth, kTileHeight, 12, false>(level);
+}
+
+TileEncoderBase *createTileEncoder(int nTileWidth, int nTileHeight,
+                                   bool compact, int level) {
+  if (nTileWidth == 8 && nTileHeight == 8) {
+    return createFor<8, 8, 9>(compact, level);
+  }
+  if (nTileWidth == 16 && nTileHeight == 16) {
+    return createFor<16, 16, 10>(compact, level);
+  }
+  if (nTileWidth == 8 && nTileHeight == 16) {
+    return createFor<8, 16, 10>(compact, level);
+  }
+  return NULL;
+}
@@ -0,0 +1,128 @@
+/* uniformTile.cpp
+ *  detection and fill of single-value tiles, 16 or 32 bytes at a time with
+ *  the kernels picked once at run time from what the CPU supports
+ */
+#include "uniformTile.h"
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define UNIFORM_TILE_X86 1
+#endif
+
+// the pixels of `pClrBlk` from byte `i` on all equal `pixel`
+static int isUniformScalar(const unsigned char *pClrBlk, int i, int nBytes,
+                           uint32_t pixel) {
+  for (; i < nBytes; i += UNIFORM_TILE_SIZE) {
+    if (memcmp(pClrBlk + i, &pixel, UNIFORM_TILE_SIZE) != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void fillScalar(unsigned char *pClrBlk, int i, int nBytes,
+                       uint32_t pixel) {
+  for (; i < nBytes; i += UNIFORM_TILE_SIZE) {
+    memcpy(pClrBlk + i, &pixel, UNIFORM_TILE_SIZE);
+  }
+}
+
+static int isUniformPlain(const unsigned char *pClrBlk, int nBytes,
+                          uint32_t pixel) {
+  return isUniformScalar(pClrBlk, 0, nBytes, pixel);
+}
+
+static void fillPlain(unsigned char *pClrBlk, int nBytes, uint32_t pixel) {
+  fillScalar(pClrBlk, 0, nBytes, pixel);
+}
+
+#ifdef UNIFORM_TILE_X86
+__attribute__((target("sse2"))) static int
+isUniformSse2(const unsigned char *pClrBlk, int nBytes, uint32_t pixel) {
+  const __m128i ref = _mm_set1_epi32((int)pixel);
+  __m128i diff = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= nBytes; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(pClrBlk + i));
+    diff = _mm_or_si128(diff, _mm_xor_si128(x, ref));
+  }
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) !=
+      0xffff) {
+    return 0;
+  }
+  return isUniformScalar(pClrBlk, i, nBytes, pixel);
+}
+
+__attribute__((target("sse2"))) static void
+fillSse2(unsigned char *pClrBlk, int nBytes, uint32_t pixel) {
+  const __m128i value = _mm_set1_epi32((int)pixel);
+  int i = 0;
+  for (; i + 16 <= nBytes; i += 16) {
+    _mm_storeu_si128((__m128i *)(pClrBlk + i), value);
+  }
+  fillScalar(pClrBlk, i, nBytes, pixel);
+}
+
+__attribute__((target("avx2"))) static int
+isUniformAvx2(const unsigned char *pClrBlk, int nBytes, uint32_t pixel) {
+  const __m256i ref = _mm256_set1_epi32((int)pixel);
+  __m256i diff = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 32 <= nBytes; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(pClrBlk + i));
+    diff = _mm256_or_si256(diff, _mm256_xor_si256(x, ref));
+  }
+  if (!_mm256_testz_si256(diff, diff)) {
+    return 0;
+  }
+  return isUniformScalar(pClrBlk, i, nBytes, pixel);
+}
+
+__attribute__((target("avx2"))) static void
+fillAvx2(unsigned char *pClrBlk, int nBytes, uint32_t pixel) {
+  const __m256i value = _mm256_set1_epi32((int)pixel);
+  int i = 0;
+  for (; i + 32 <= nBytes; i += 32) {
+    _mm256_storeu_si256((__m256i *)(pClrBlk + i), value);
+  }
+  fillScalar(pClrBlk, i, nBytes, pixel);
+}
+#endif
+
+typedef struct _UniformKernels {
+  int (*isUniform)(const unsigned char *, int, uint32_t);
+  void (*fill)(unsigned char *, int, uint32_t);
+} UniformKernels;
+
+static UniformKernels selectKernels() {
+#ifdef UNIFORM_TILE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {isUniformAvx2, fillAvx2};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return {isUniformSse2, fillSse2};
+  }
+#endif
+  return {isUniformPlain, fillPlain};
+}
+
+static const UniformKernels &kernels() {
+  static const UniformKernels s_kernels = selectKernels();
+  return s_kernels;
+}
+
+int tileIsUniform(const unsigned char *pClrBlk, int nBytes) {
+  uint32_t pixel;
+  memcpy(&pixel, pClrBlk, UNIFORM_TILE_SIZE);
+  return kernels().isUniform(pClrBlk, nBytes, pixel);
+}
+
+void tileFillUniform(unsigned char *pClrBlk, const unsigned char *pPixel,
+                     int nBytes) {
+  uint32_t pixel;
+  memcpy(&pixel, pPixel, UNIFORM_TILE_SIZE);
+  kernels().fill(pClrBlk, nBytes, pixel);
+}